@@ -2,12 +2,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
 #include <glob.h>
 #include <dirent.h> 
 
 #ifdef _WIN32
     #include <io.h>  
+    #include <direct.h>
+    #include <sys/utime.h>
     #include <windows.h>  
     #define getcwd _getcwd
     #define SHARED_NAME ".dll"
@@ -16,6 +21,20 @@
 #else
     #include <unistd.h>   
     #include <sys/stat.h> 
+    #include <limits.h>
+    #include <errno.h>
+    #include <pthread.h>
+    #include <spawn.h>
+    #include <sys/wait.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <utime.h>
+    #include <sys/resource.h>
+    #include <regex.h>
+    #include <poll.h>
+    #ifdef __linux__
+        #include <sys/inotify.h>
+    #endif
     #ifdef __APPLE__
         #define EXE_RULES "-Wl,-rpath,@loader_path"
         #define LINK_RULES "-Wl,-install_name,@loader_path/libpocketpy.dylib -Wl,-rpath,@loader_path" 
@@ -31,126 +50,773 @@
 #define DEBUG 1
 #endif
 
+// Configure state that sibling subdirectories fill in separately while they
+// run on configure threads (see Parallel Subdirectories)
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Log levels, most severe first. --log-level=<name> picks how much is shown
+// at run time; a disabled call costs one compare and evaluates no arguments.
+// Building with -DDEBUG=0 removes the debug and trace calls altogether.
+enum { LOG_ERROR, LOG_WARNING, LOG_NOTICE, LOG_STATUS, LOG_VERBOSE, LOG_DEBUG, LOG_TRACE };
+static int log_level = LOG_STATUS;
+static void log_printf(int level, const char *fmt, ...);
+
 #if DEBUG
-#define DPRINTF(...) do { printf("DEBUG: "); printf(__VA_ARGS__); } while(0)
+#define DPRINTF(...) do { if (log_level >= LOG_DEBUG) log_printf(LOG_DEBUG, __VA_ARGS__); } while(0)
+#define TPRINTF(...) do { if (log_level >= LOG_TRACE) log_printf(LOG_TRACE, __VA_ARGS__); } while(0)
 #else
 #define DPRINTF(...) do {} while(0)
+#define TPRINTF(...) do {} while(0)
 #endif
 
-#define MAX_LINE 1024
-#define MAX_VARS 512
-#define MAX_TARGETS 128
 #define MAX_DEFS 64
 #define MAX_LIBS 64
 #define MAX_INCS 32
-#define MAX_SRCS 128
-#define MAX_STACK 32
+
+// ---- Arena Allocator ----
+// Configure-time strings and lists live until the process exits, so they are
+// bump-allocated from large chunks instead of malloc'd one at a time.
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used, cap;
+    char data[];
+} ArenaChunk;
+typedef struct {
+    ArenaChunk *head;
+    size_t total;       // bytes reserved from malloc, for reporting
+    size_t peak;        // highest total so far
+    size_t nalloc;      // arena_alloc() calls and the bytes they asked for,
+    size_t nbyte;       // for --bench
+} Arena;
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+static THREAD_LOCAL Arena config_arena;   // everything the configure step keeps
+static THREAD_LOCAL Arena scratch_arena;  // per-command temporaries, reset after each one
+static Arena intern_arena;                // interned names, kept when --watch configures again
+
+static void *arena_alloc(Arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    a->nalloc++;
+    a->nbyte += n;
+    ArenaChunk *c = a->head;
+    if (!c || c->cap - c->used < n) {
+        // The tail of the old chunk is smaller than n, so at most half is wasted
+        size_t cap = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+        c = malloc(sizeof(ArenaChunk) + cap);
+        if (!c) { puts("Out of memory."); exit(1); }
+        c->used = 0;
+        c->cap = cap;
+        c->next = a->head;
+        a->head = c;
+        a->total += cap;
+        if (a->total > a->peak) a->peak = a->total;
+    }
+    void *p = c->data + c->used;
+    c->used += n;
+    return p;
+}
+static char *arena_strndup(Arena *a, const char *s, size_t len) {
+    char *p = arena_alloc(a, len + 1);
+    memcpy(p, s, len);
+    p[len] = 0;
+    return p;
+}
+static char *arena_strdup(Arena *a, const char *s) { return arena_strndup(a, s, strlen(s)); }
+static void arena_free(Arena *a) {
+    while (a->head) {
+        ArenaChunk *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->total = 0;
+}
+// Keeps the newest chunk for reuse and releases the rest
+static void arena_reset(Arena *a) {
+    if (!a->head) return;
+    ArenaChunk *c = a->head->next;
+    while (c) {
+        ArenaChunk *next = c->next;
+        a->total -= c->cap;
+        free(c);
+        c = next;
+    }
+    a->head->next = NULL;
+    a->head->used = 0;
+}
+// Scratch allocations made while a command runs are released afterwards;
+// marks nest, so an include() inside a command keeps the caller's data
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+static ArenaMark arena_mark(Arena *a) {
+    if (!a->head) arena_alloc(a, 0);
+    ArenaMark m = { a->head, a->head->used };
+    return m;
+}
+static void arena_release(Arena *a, ArenaMark m) {
+    while (a->head != m.chunk) {
+        ArenaChunk *c = a->head;
+        a->head = c->next;
+        a->total -= c->cap;
+        free(c);
+    }
+    a->head->used = m.used;
+}
+// Moves every chunk of `from` into a, leaving `from` empty. They go behind
+// a's current chunk, so allocation carries on where it was.
+static void arena_adopt(Arena *a, Arena *from) {
+    if (from->head) {
+        ArenaChunk *last = from->head;
+        while (last->next) last = last->next;
+        if (a->head) {
+            last->next = a->head->next;
+            a->head->next = from->head;
+        } else {
+            a->head = from->head;
+        }
+    }
+    a->total += from->total;
+    if (a->total > a->peak) a->peak = a->total;
+    a->nalloc += from->nalloc;
+    a->nbyte += from->nbyte;
+    memset(from, 0, sizeof *from);
+}
+// Grows an arena-backed array holding `count` elements so one more fits.
+// Capacity is implied by the count: 4, then doubling at every power of two.
+static void *arena_grow(Arena *a, void *items, int count, size_t elem) {
+    if (count > 0 && (count < 4 || (count & (count - 1)) != 0)) return items;
+    size_t cap = count < 4 ? 4 : (size_t)count * 2;
+    void *bigger = arena_alloc(a, cap * elem);
+    if (count) memcpy(bigger, items, (size_t)count * elem);
+    return bigger;
+}
 
 // ---- Helper functions ----
+static const char *const log_level_names[] = {
+    "ERROR", "WARNING", "NOTICE", "STATUS", "VERBOSE", "DEBUG", "TRACE",
+};
+// Configure messages go to stdout, or to a buffer while the directory runs on
+// a configure thread; the buffers are printed in the order a serial run would
+static THREAD_LOCAL FILE *message_buf;
+static FILE *message_out(void) { return message_buf ? message_buf : stdout; }
+
+static void log_printf(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(message_out(), "%s: ", log_level_names[level]);
+    vfprintf(message_out(), fmt, ap);
+    va_end(ap);
+}
+// -1 for an unknown name
+static int parse_log_level(const char *name) {
+    for (int i = 0; i < (int)(sizeof log_level_names / sizeof log_level_names[0]); i++)
+        if (strcasecmp(name, log_level_names[i]) == 0) return i;
+    return -1;
+}
 static int has_suffix(const char *name, const char *ext) {
     size_t nlen = strlen(name);
     size_t elen = strlen(ext);
     return nlen >= elen && strcmp(name + nlen - elen, ext) == 0;
 }
-static void add_string(char ***list, int *count, const char *value) { *list = realloc(*list, (*count + 1) * sizeof(char *)); (*list)[*count] = strdup(value); (*count)++; }
-void append_to_buf(char **buf, size_t *buflen, const char *path) {
-    size_t need = strlen(*buf) + strlen(path) + 2;
-    if (need > *buflen) {
-        *buflen = need * 2;
-        *buf = realloc(*buf, *buflen);
-        if (!*buf) return;
+// FNV-1a, continuing from h; start with HASH_SEED
+#define HASH_SEED 14695981039346656037ULL
+static unsigned long long hash_bytes(const void *data, size_t len, unsigned long long h) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+static void add_string(char ***list, int *count, const char *value) { *list = arena_grow(&config_arena, *list, *count, sizeof(char *)); (*list)[*count] = arena_strdup(&config_arena, value); (*count)++; }
+// Modification time in nanoseconds
+static long long stat_mtime(const struct stat *st) {
+#if defined(_WIN32)
+    return (long long)st->st_mtime * 1000000000LL;
+#elif defined(__APPLE__)
+    return (long long)st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+// -1 if the file does not exist
+static long long file_mtime(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return stat_mtime(&st);
+}
+static void make_parent_dirs(const char *path) {
+    char tmp[4096];
+    snprintf(tmp, sizeof tmp, "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+#ifdef _WIN32
+        _mkdir(tmp);
+#else
+        mkdir(tmp, 0777);
+#endif
+        *p = '/';
     }
-    strcat(*buf, path);
-    strcat(*buf, " ");
 }
+// Every file(GLOB) pattern evaluated during configure. A changed directory
+// mtime means entries were added or removed there, which may change the result.
+enum { GLOB_RECURSE_BIT = 1, GLOB_LIST_DIRS = 2, GLOB_FOLLOW = 4, GLOB_CONFIGURE_DEPENDS = 8 };
+typedef struct {
+    const char *pattern;
+    int flags;              // GLOB_* bits
+    char **dirs;            // every directory read, sorted
+    long long *dir_mtimes;
+    int ndir;
+    char **matches;         // sorted
+    int nmatch;
+} GlobRecord;
+static THREAD_LOCAL GlobRecord *glob_records = NULL;
+static THREAD_LOCAL int nglob_record = 0;
+static GlobRecord *new_glob_record(const char *pattern, int flags) {
+    glob_records = arena_grow(&config_arena, glob_records, nglob_record, sizeof(GlobRecord));
+    GlobRecord *rec = &glob_records[nglob_record++];
+    memset(rec, 0, sizeof *rec);
+    rec->pattern = arena_strdup(&config_arena, pattern);
+    rec->flags = flags;
+    return rec;
+}
+static void glob_record_dir(GlobRecord *rec, const char *dir, long long mtime) {
+    rec->dir_mtimes = arena_grow(&config_arena, rec->dir_mtimes, rec->ndir, sizeof(long long));
+    rec->dir_mtimes[rec->ndir] = mtime;
+    add_string(&rec->dirs, &rec->ndir, dir);
+}
+// ---- Configure Profile ----
+// --profile-configure: where configure time goes. Counters and timing are
+// only kept when enabled, which also keeps configure on one thread.
+typedef struct {
+    char *name;
+    long long us;
+    long count;
+} ProfileEntry;
+static struct {
+    int enabled;
+    long long getvar_calls;
+    long long expanded_bytes;
+    long long glob_dirs, glob_stats;
+    ProfileEntry *cmds;         // self time: nested commands are not included
+    ProfileEntry *scripts;      // total time, reading the file included
+    int ncmd, nscript;
+    long long nested_us;        // time of commands run inside the current one
+} prof;
+
+static long long monotonic_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long long)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+}
+static ProfileEntry *profile_entry(ProfileEntry **list, int *n, const char *name, size_t len) {
+    for (int i = 0; i < *n; i++)
+        if (strlen((*list)[i].name) == len && memcmp((*list)[i].name, name, len) == 0) return &(*list)[i];
+    *list = realloc(*list, (*n + 1) * sizeof(ProfileEntry));
+    ProfileEntry *e = &(*list)[(*n)++];
+    e->name = malloc(len + 1);
+    memcpy(e->name, name, len);
+    e->name[len] = 0;
+    e->us = 0;
+    e->count = 0;
+    return e;
+}
+static int cmp_profile_entry(const void *a, const void *b) {
+    long long x = ((const ProfileEntry *)a)->us, y = ((const ProfileEntry *)b)->us;
+    return x > y ? -1 : x < y;
+}
+static void print_profile_entries(const char *title, ProfileEntry *list, int n) {
+    qsort(list, n, sizeof(ProfileEntry), cmp_profile_entry);
+    printf("--   %s:\n", title);
+    for (int i = 0; i < n; i++)
+        printf("--   %10.3f ms %8ld  %s\n", list[i].us / 1000.0, list[i].count, list[i].name);
+}
+static void print_configure_profile(long long total_us) {
+    printf("-- Configure profile: %.3f ms\n", total_us / 1000.0);
+    print_profile_entries("commands, self time", prof.cmds, prof.ncmd);
+    print_profile_entries("script files, total time", prof.scripts, prof.nscript);
+    printf("--   getvar lookups: %lld\n", prof.getvar_calls);
+    printf("--   bytes expanded: %lld\n", prof.expanded_bytes);
+    printf("--   file(GLOB): %lld directories read, %lld files stat'ed\n", prof.glob_dirs, prof.glob_stats);
+    printf("--   arenas: %.1f MiB configure, %.1f MiB scratch peak\n",
+           (config_arena.peak + intern_arena.peak) / 1048576.0, scratch_arena.peak / 1048576.0);
 #ifndef _WIN32
-void collect_files(const char *dir, char **buf, size_t *buflen, const char *ext) {
-    DIR *dp = opendir(dir);
-    if (!dp) return;
-    struct dirent *entry;
-    while ((entry = readdir(dp))) {
-        if (!strcmp(entry->d_name,".") || !strcmp(entry->d_name,"..")) continue;
-
-        char path[1024];
-        snprintf(path,sizeof(path),"%s/%s",dir,entry->d_name);
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+        double rss = ru.ru_maxrss / 1048576.0;     // bytes
+#else
+        double rss = ru.ru_maxrss / 1024.0;        // KiB
+#endif
+        printf("--   peak RSS: %.1f MiB\n", rss);
+    }
+#endif
+}
 
-        struct stat st;
-        if (stat(path,&st)==0) {
-            if (S_ISDIR(st.st_mode)) {
-                collect_files(path, buf, buflen, ext);
-            } else if (S_ISREG(st.st_mode)) {
-                if (!ext || has_suffix(entry->d_name, ext)) {
-                    append_to_buf(buf, buflen, path);
+// ---- Directory Walker ----
+// file(GLOB) patterns are split into the literal directory they start from and
+// the wildcard part matched below it, so only that subtree is read
+typedef struct {
+    char *root;         // "" for the current directory
+    const char *rest;   // pattern relative to root
+    int depth;          // path components in rest
+    int recurse;        // GLOB_RECURSE
+    int list_dirs;      // LIST_DIRECTORIES
+    int follow;         // FOLLOW_SYMLINKS
+    int configure_depends;
+} GlobSpec;
+
+// Matches *, ? and [...] like fnmatch(); with cross_dirs, * and ? also match '/'
+static int wildcard_match(const char *p, const char *s, int cross_dirs) {
+    for (; *p; p++, s++) {
+        if (*p == '*') {
+            while (p[1] == '*') p++;
+            for (;; s++) {
+                if (wildcard_match(p + 1, s, cross_dirs)) return 1;
+                if (!*s || (*s == '/' && !cross_dirs)) return 0;
+            }
+        }
+        if (!*s || (*s == '/' && !cross_dirs && *p != '/')) return 0;
+        if (*p == '?') continue;
+        if (*p == '[') {
+            const char *q = p + 1;
+            int neg = *q == '!' || *q == '^';
+            if (neg) q++;
+            const char *close = *q ? strchr(q + 1, ']') : NULL;
+            if (close) {
+                int hit = 0;
+                while (q < close) {
+                    if (q[1] == '-' && q + 2 < close) {
+                        if (*s >= q[0] && *s <= q[2]) hit = 1;
+                        q += 3;
+                    } else {
+                        if (*s == *q) hit = 1;
+                        q++;
+                    }
                 }
-            } else if (S_ISDIR(st.st_mode)) {
-                collect_files(path, buf, buflen, ext);
+                if (hit == neg) return 0;
+                p = close;
+                continue;
             }
+        }
+        if (*p != *s) return 0;
+    }
+    return !*s;
+}
+static int has_wildcard(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[') return 1;
+    return 0;
+}
+static void glob_spec_init(GlobSpec *g, const char *pattern) {
+    // Root is every leading directory component without a wildcard in it
+    size_t root_len = 0;
+    for (const char *p = pattern; (p = strchr(p, '/')); p++) {
+        if (has_wildcard(pattern, p - pattern)) break;
+        root_len = p - pattern;
+    }
+    g->root = arena_strndup(&scratch_arena, pattern, root_len);
+    if (root_len == 0 && pattern[0] == '/') g->root = arena_strdup(&scratch_arena, "/");
+    g->rest = pattern + root_len + (pattern[root_len] == '/');
+    g->depth = 1;
+    for (const char *p = g->rest; *p; p++) g->depth += *p == '/';
+}
+static int glob_matches(const GlobSpec *g, const char *rel, const char *name) {
+    // GLOB_RECURSE tries a plain file pattern in every directory below the root
+    if (g->recurse && !strchr(g->rest, '/')) return wildcard_match(g->rest, name, 0);
+    return wildcard_match(g->rest, rel, g->recurse);
+}
+
+// What one walker thread found; the arena is freed after the merge
+typedef struct {
+    Arena arena;
+    char **files;
+    int nfile;
+    char **dirs;            // every directory read, for the configure cache
+    long long *dir_mtimes;
+    int ndir;
+    long nstat;             // stat calls, for --profile-configure
+} WalkResult;
+
+static char *walk_join(Arena *a, const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    int sep = dlen && dir[dlen - 1] != '/';
+    char *path = arena_alloc(a, dlen + sep + nlen + 1);
+    memcpy(path, dir, dlen);
+    if (sep) path[dlen] = '/';
+    memcpy(path + dlen + sep, name, nlen + 1);
+    return path;
+}
+static void walk_add(Arena *a, char ***list, int *count, char *path) {
+    *list = arena_grow(a, *list, *count, sizeof(char *));
+    (*list)[(*count)++] = path;
+}
+static void walk_note_dir(WalkResult *r, char *path, long long mtime) {
+    r->dir_mtimes = arena_grow(&r->arena, r->dir_mtimes, r->ndir, sizeof(long long));
+    r->dir_mtimes[r->ndir] = mtime;
+    walk_add(&r->arena, &r->dirs, &r->ndir, path);
+}
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+typedef struct {
+    char *path;
+    int depth;
+} WalkDir;
+typedef struct WalkQueue WalkQueue;
+typedef struct {
+    const GlobSpec *spec;
+    WalkQueue *queue;
+    WalkResult result;
+    WalkDir *found;         // subdirectories of the directory just read
+    int nfound, found_cap;
+} WalkThread;
+
+static void walk_found(WalkThread *w, char *path, int depth) {
+    if (w->nfound == w->found_cap) {
+        w->found_cap = w->found_cap ? w->found_cap * 2 : 16;
+        w->found = realloc(w->found, w->found_cap * sizeof(WalkDir));
+    }
+    w->found[w->nfound].path = path;
+    w->found[w->nfound].depth = depth;
+    w->nfound++;
+}
 
+#ifndef _WIN32
+// Directories waiting to be read, shared by all walker threads
+struct WalkQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    WalkDir *pending;
+    int npending, cap;
+    int busy;               // threads reading a directory, which may queue more
+};
+
+// Reads one directory. d_type tells files from directories without a stat();
+// fstatat() is only needed for symlinks and filesystems that leave it unknown.
+static void walk_dir(WalkThread *w, const char *path, int depth) {
+    const GlobSpec *g = w->spec;
+    WalkResult *r = &w->result;
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    r->nstat++;
+    if (fstat(fd, &st) == 0) walk_note_dir(r, arena_strdup(&r->arena, *path ? path : "."), stat_mtime(&st));
+    DIR *dp = fdopendir(fd);
+    if (!dp) { close(fd); return; }
+
+    size_t skip = strlen(g->root);
+    if (skip && g->root[skip - 1] != '/') skip++;
+    struct dirent *entry;
+    while ((entry = readdir(dp))) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+
+        int is_dir = entry->d_type == DT_DIR, descend = is_dir;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            int link = entry->d_type == DT_LNK;
+            r->nstat += link ? 1 : 2;
+            if (!link && fstatat(dirfd(dp), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                link = S_ISLNK(st.st_mode);
+            is_dir = fstatat(dirfd(dp), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            // A symlink to a directory is listed like a file unless followed
+            descend = is_dir && (!link || g->follow);
+            if (link && !descend) is_dir = 0;
         }
+
+        char *child = walk_join(&r->arena, path, name);
+        if (descend && (g->recurse || depth + 1 < g->depth)) walk_found(w, child, depth + 1);
+        if ((!is_dir || g->list_dirs) && glob_matches(g, child + skip, name))
+            walk_add(&r->arena, &r->files, &r->nfile, child);
     }
     closedir(dp);
 }
+static void *walk_worker(void *arg) {
+    WalkThread *w = arg;
+    WalkQueue *q = w->queue;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->npending && q->busy) pthread_cond_wait(&q->wake, &q->lock);
+        if (!q->npending) break;    // nothing queued and nobody left to queue more
+        WalkDir d = q->pending[--q->npending];
+        q->busy++;
+        pthread_mutex_unlock(&q->lock);
+
+        w->nfound = 0;
+        walk_dir(w, d.path, d.depth);
+
+        pthread_mutex_lock(&q->lock);
+        if (q->npending + w->nfound > q->cap) {
+            q->cap = (q->npending + w->nfound) * 2;
+            q->pending = realloc(q->pending, q->cap * sizeof(WalkDir));
+        }
+        memcpy(q->pending + q->npending, w->found, w->nfound * sizeof(WalkDir));
+        q->npending += w->nfound;
+        q->busy--;
+        if (w->nfound || !q->busy) pthread_cond_broadcast(&q->wake);
+    }
+    pthread_mutex_unlock(&q->lock);
+    free(w->found);
+    return NULL;
+}
+// Walks the tree under g->root with a pool of threads pulling directories off
+// one queue. Returns the per-thread results; *nresult is the thread count.
+static WalkResult *walk_tree(const GlobSpec *g, int *nresult) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthread = g->recurse ? (ncpu < 1 ? 1 : ncpu > 8 ? 8 : (int)ncpu) : 1;
+
+    WalkQueue q = {0};
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.wake, NULL);
+    q.cap = 64;
+    q.pending = malloc(q.cap * sizeof(WalkDir));
+    q.pending[0].path = g->root;
+    q.pending[0].depth = 0;
+    q.npending = 1;
+
+    WalkThread *threads = calloc(nthread, sizeof(WalkThread));
+    pthread_t *tids = malloc(nthread * sizeof(pthread_t));
+    for (int i = 0; i < nthread; i++) {
+        threads[i].spec = g;
+        threads[i].queue = &q;
+    }
+    for (int i = 1; i < nthread; i++) pthread_create(&tids[i], NULL, walk_worker, &threads[i]);
+    walk_worker(&threads[0]);
+    for (int i = 1; i < nthread; i++) pthread_join(tids[i], NULL);
+
+    WalkResult *results = malloc(nthread * sizeof(WalkResult));
+    for (int i = 0; i < nthread; i++) results[i] = threads[i].result;
+    free(threads);
+    free(tids);
+    free(q.pending);
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.wake);
+    *nresult = nthread;
+    return results;
+}
 #else
-void collect_files(const char *dir, char **buf, size_t *buflen, const char *ext) {
-    char searchPath[MAX_PATH];
-    snprintf(searchPath, sizeof(searchPath), "%s\\*", dir);
+static void walk_dir(WalkThread *w, const char *path, int depth) {
+    const GlobSpec *g = w->spec;
+    WalkResult *r = &w->result;
+    char search[MAX_PATH];
+    snprintf(search, sizeof(search), "%s\\*", *path ? path : ".");
 
     WIN32_FIND_DATAA ffd;
-    HANDLE hFind = FindFirstFileA(searchPath, &ffd);
+    HANDLE hFind = FindFirstFileA(search, &ffd);
     if (hFind == INVALID_HANDLE_VALUE) return;
+    r->nstat++;
+    walk_note_dir(r, arena_strdup(&r->arena, *path ? path : "."), file_mtime(*path ? path : "."));
 
+    size_t skip = strlen(g->root);
+    if (skip && g->root[skip - 1] != '/') skip++;
     do {
         const char *name = ffd.cFileName;
         if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
 
-        char path[MAX_PATH];
-        snprintf(path, sizeof(path), "%s\\%s", dir, name);
-
-        if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            collect_files(path, buf, buflen, ext);
-        } else {
-            if (!ext || has_suffix(name, ext)) {
-                append_to_buf(buf, buflen, path);
-            }
-        }
+        char *child = walk_join(&r->arena, path, name);
+        int is_dir = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if (is_dir && (g->recurse || depth + 1 < g->depth)) walk_found(w, child, depth + 1);
+        if ((!is_dir || g->list_dirs) && glob_matches(g, child + skip, name))
+            walk_add(&r->arena, &r->files, &r->nfile, child);
     } while (FindNextFileA(hFind, &ffd));
 
     FindClose(hFind);
 }
+static WalkResult *walk_tree(const GlobSpec *g, int *nresult) {
+    WalkThread w = { .spec = g };
+    WalkDir *stack = malloc(sizeof(WalkDir));
+    int nstack = 1;
+    stack[0].path = g->root;
+    stack[0].depth = 0;
+    while (nstack) {
+        WalkDir d = stack[--nstack];
+        w.nfound = 0;
+        walk_dir(&w, d.path, d.depth);
+        stack = realloc(stack, (nstack + w.nfound + 1) * sizeof(WalkDir));
+        memcpy(stack + nstack, w.found, w.nfound * sizeof(WalkDir));
+        nstack += w.nfound;
+    }
+    free(stack);
+    free(w.found);
+
+    WalkResult *results = malloc(sizeof(WalkResult));
+    results[0] = w.result;
+    *nresult = 1;
+    return results;
+}
 #endif
-static void trim_token(char *s) {
-    if (!s) return;
-    size_t len = strlen(s);
-    while (len && (s[len-1] == ' ' || s[len-1] == '\t' ||
-                   s[len-1] == '\n' || s[len-1] == ')')) {
-        s[--len] = 0;
+
+// Expands one file(GLOB) pattern: matches are appended to *files (scratch
+// arena), the pattern and every directory read go into a GlobRecord
+static void glob_pattern(GlobSpec *g, const char *pattern, char ***files, int *nfile) {
+    glob_spec_init(g, pattern);
+    if (!has_wildcard(g->rest, strlen(g->rest))) {
+        // A plain path names one file, nothing to walk
+        if (prof.enabled) prof.glob_stats++;
+        if (file_mtime(pattern) >= 0) walk_add(&scratch_arena, files, nfile, arena_strdup(&scratch_arena, pattern));
+        return;
+    }
+
+    int nresult;
+    WalkResult *results = walk_tree(g, &nresult);
+
+    // Merge the per-thread lists, sorted so the result does not depend on timing
+    int first = *nfile, ndir = 0;
+    for (int i = 0; i < nresult; i++) {
+        for (int j = 0; j < results[i].nfile; j++)
+            walk_add(&scratch_arena, files, nfile, arena_strdup(&scratch_arena, results[i].files[j]));
+        ndir += results[i].ndir;
+        if (prof.enabled) prof.glob_stats += results[i].nstat;
+    }
+    if (prof.enabled) prof.glob_dirs += ndir;
+    qsort(*files + first, *nfile - first, sizeof(char *), cmp_str);
+
+    typedef struct { char *path; long long mtime; } DirStamp;
+    DirStamp *dirs = malloc((ndir ? ndir : 1) * sizeof(DirStamp));
+    ndir = 0;
+    for (int i = 0; i < nresult; i++)
+        for (int j = 0; j < results[i].ndir; j++) {
+            dirs[ndir].path = results[i].dirs[j];
+            dirs[ndir].mtime = results[i].dir_mtimes[j];
+            ndir++;
+        }
+    qsort(dirs, ndir, sizeof(DirStamp), cmp_str);
+
+    GlobRecord *rec = new_glob_record(pattern, (g->recurse ? GLOB_RECURSE_BIT : 0) |
+                                               (g->list_dirs ? GLOB_LIST_DIRS : 0) |
+                                               (g->follow ? GLOB_FOLLOW : 0) |
+                                               (g->configure_depends ? GLOB_CONFIGURE_DEPENDS : 0));
+    for (int i = 0; i < ndir; i++) glob_record_dir(rec, dirs[i].path, dirs[i].mtime);
+    for (int i = first; i < *nfile; i++) add_string(&rec->matches, &rec->nmatch, (*files)[i]);
+    free(dirs);
+
+    for (int i = 0; i < nresult; i++) arena_free(&results[i].arena);
+    free(results);
+}
+
+static int find_sorted(char **list, int n, const char *s) {
+    char **hit = bsearch(&s, list, n, sizeof(char *), cmp_str);
+    return hit ? (int)(hit - list) : -1;
+}
+// Directory a walk reported `path` in: "." for the current one
+static const char *walk_parent(const char *path, char *buf, size_t len) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) return ".";
+    if (slash == path) return "/";
+    snprintf(buf, len, "%.*s", (int)(slash - path), path);
+    return buf;
+}
+// Checks a recorded glob against the file system. Only directories whose
+// mtime changed are read again; matches in the others are still valid.
+// Returns 1 if the set of matches is the same as when it was recorded.
+static int glob_unchanged(const GlobRecord *rec) {
+    char *changed = calloc(rec->ndir ? rec->ndir : 1, 1);
+    int nchanged = 0;
+    for (int i = 0; i < rec->ndir; i++)
+        if (file_mtime(rec->dirs[i]) != rec->dir_mtimes[i]) changed[i] = 1, nchanged++;
+    if (!nchanged) {
+        free(changed);
+        return 1;
+    }
+
+    GlobSpec g = {0};
+    g.recurse = (rec->flags & GLOB_RECURSE_BIT) != 0;
+    g.list_dirs = (rec->flags & GLOB_LIST_DIRS) != 0;
+    g.follow = (rec->flags & GLOB_FOLLOW) != 0;
+    ArenaMark mark = arena_mark(&scratch_arena);
+    glob_spec_init(&g, rec->pattern);
+    size_t skip = strlen(g.root);
+    if (skip && g.root[skip - 1] != '/') skip++;
+
+    // Matches from unchanged directories carry over
+    char **now = NULL;
+    int nnow = 0;
+    char parent[4096];
+    for (int i = 0; i < rec->nmatch; i++) {
+        int d = find_sorted(rec->dirs, rec->ndir, walk_parent(rec->matches[i], parent, sizeof parent));
+        if (d >= 0 && !changed[d]) walk_add(&scratch_arena, &now, &nnow, rec->matches[i]);
     }
-    while (*s == ' ' || *s == '\t' || *s == '\n') {
-        memmove(s, s+1, strlen(s));
+
+    // Changed directories are read again, plus any subdirectory that is new
+    WalkThread w = { .spec = &g };
+    WalkDir *stack = malloc(nchanged * sizeof(WalkDir));
+    int nstack = 0;
+    for (int i = 0; i < rec->ndir; i++) {
+        if (!changed[i]) continue;
+        const char *dir = rec->dirs[i];
+        if (!*g.root && strcmp(dir, ".") == 0) dir = "";
+        const char *rel = strlen(dir) >= skip ? dir + skip : "";
+        int depth = *rel ? 1 : 0;
+        for (const char *p = rel; *p; p++) depth += *p == '/';
+        stack[nstack].path = (char *)dir;
+        stack[nstack].depth = depth;
+        nstack++;
     }
-    len = strlen(s);
-    if (len >= 2 && s[0] == '"' && s[len-1] == '"') {
-        s[len-1] = 0;
-        memmove(s, s+1, strlen(s));
+    while (nstack) {
+        WalkDir d = stack[--nstack];
+        w.nfound = 0;
+        walk_dir(&w, d.path, d.depth);
+        stack = realloc(stack, (nstack + w.nfound + 1) * sizeof(WalkDir));
+        for (int i = 0; i < w.nfound; i++)
+            if (find_sorted(rec->dirs, rec->ndir, w.found[i].path) < 0) stack[nstack++] = w.found[i];
     }
+    for (int i = 0; i < w.result.nfile; i++) walk_add(&scratch_arena, &now, &nnow, w.result.files[i]);
+    qsort(now, nnow, sizeof(char *), cmp_str);
+
+    int same = nnow == rec->nmatch;
+    for (int i = 0; same && i < nnow; i++) same = strcmp(now[i], rec->matches[i]) == 0;
+    if (!same) DPRINTF("file(GLOB) result changed: %s\n", rec->pattern);
+
+    free(stack);
+    free(w.found);
+    free(changed);
+    arena_free(&w.result.arena);
+    arena_release(&scratch_arena, mark);
+    return same;
 }
 // ---- Variable Table ----
+// A variable holds a string, or a list of interned elements whose
+// ;-joined string is only built when something asks for it
 typedef struct {
-    char *key;
-    char *val;
+    char *str;              // NULL for a list not joined yet
+    const char **items;     // list elements, NULL for a string
+    int nitem;
+} Value;
+typedef struct {
+    const char *key;    // interned, so keys compare by pointer
+    Value val;          // str and items both NULL: undefined
 } Var;
-Var vars[MAX_VARS];
-int nvars = 0;
-static char **global_incs = NULL;
-static int nglobal_incs = 0;
+static THREAD_LOCAL char **global_incs = NULL;
+static THREAD_LOCAL int nglobal_incs = 0;
+// Every script read during configure; the build re-runs configure when one changes
+static THREAD_LOCAL char **script_files = NULL;
+static THREAD_LOCAL int nscript_files = 0;
 // ---- Target Table ----
 typedef struct {
-    char name[128];
+    const char *name;   // interned
     char type[16];
 
     char **srcs;
     int nsrc;
 
+    char **props;           // set_target_properties(), as key, value pairs
+    int nprop;
+
+    // PRIVATE and PUBLIC items, used by the target itself
     char **defs;
     int ndef;
 
@@ -159,768 +825,5265 @@ typedef struct {
 
     char **libs;
     int nlib;
+
+    char **pchs;            // target_precompile_headers
+    int npch;
+    const char *pch_reuse;  // REUSE_FROM target, or NULL
+
+    // PUBLIC and INTERFACE items, passed on to targets that link to this one
+    char **iface_defs;
+    int niface_def;
+
+    char **iface_incs;
+    int niface_inc;
+
+    char **iface_libs;
+    int niface_lib;
+
+    char **iface_pchs;
+    int niface_pch;
+
+    // Filled in once by resolve_targets() from the lists above
+    char **use_defs;        // own and inherited, de-duplicated
+    int nuse_def;
+    char **use_incs;
+    int nuse_inc;
+    char **use_pchs;
+    int nuse_pch;
+    char **compile_srcs;    // what is compiled: srcs, or unity files plus opt-outs
+    int ncompile_src;
+    char **link_items;      // link line order, dependents before dependencies
+    int nlink_item;
+    char **all_iface_defs;  // transitive interface, for dependents
+    int nall_iface_def;
+    char **all_iface_incs;
+    int nall_iface_inc;
+    char **all_iface_pchs;
+    int nall_iface_pch;
+    int resolve_state;      // 0 new, 1 in progress, 2 done
+    const char *dir_flags;  // CMAKE_C_FLAGS of the defining directory, at its end
+    int dir;                // --watch: the WatchDir that defined it
+    const char *rules;      // --watch: what the generator last wrote for it
 } Target;
 
-Target targets[MAX_TARGETS];
-int ntarget = 0;
+THREAD_LOCAL Target *targets = NULL;
+THREAD_LOCAL int ntarget = 0;
+static THREAD_LOCAL int targets_cap = 0;
 
-// ---- Condition Stack ----
-int cond_stack[MAX_STACK];
-int cond_level = 0;
+// ---- String Interning ----
+// Every variable name is stored once; lookups hash the text a single time and
+// everything after that compares pointers. The table is shared by all
+// configure threads and locked once there can be more than one.
+static const char **intern_slots = NULL;
+static size_t intern_cap = 0, intern_count = 0;
+#ifndef _WIN32
+static pthread_rwlock_t intern_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int intern_locked = 0;
+#endif
 
-// ---- Variable Table ----
-const char *getvar(const char *key) {
-    for (int i = 0; i < nvars; ++i)
-        if (strcmp(vars[i].key, key) == 0) return vars[i].val;
-    return "";
-}
-void setvar(const char *key, const char *val) {
-    for (int i = 0; i < nvars; ++i) {
-        if (strcmp(vars[i].key, key) == 0) {
-            free(vars[i].val);
-            vars[i].val = strdup(val);
-            return;
-        }
+static size_t hash_str(const char *s, size_t len) {
+    size_t h = (size_t)14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= (size_t)1099511628211ULL;
     }
-
-    vars[nvars].key = strdup(key);
-    vars[nvars].val = strdup(val);
-    nvars++;
+    return h;
 }
-
-// --- Variable Expansion ---
-void expand_vars(const char *src, char *buf, int buflen) {
-    char *dst = buf;
-    const char *p = src;
-    while (*p && (dst - buf) < buflen - 1) {
-        if (p[0] == '$' && p[1] == '{') {
-            const char *end = strchr(p, '}');
-            if (!end) { *dst++ = *p++; continue; }
-            char key[256];
-            size_t len = end - (p + 2);
-            if (len >= sizeof(key)) len = sizeof(key) - 1;
-            memcpy(key, p + 2, len);
-            key[len] = '\0';
-
-            const char *val = getvar(key);
-            if (!val) val = "";
-            if (DEBUG) DPRINTF("Expanding variable: ${%s} -> %s\n", key, val);
-
-            for (const char *v = val; *v && (dst - buf) < buflen - 1; ++v) *dst++ = *v;
-            p = end + 1;
-        } else {
-            *dst++ = *p++;
-        }
-    }
-    *dst = '\0';
+static size_t intern_slot(const char *s, size_t len) {
+    size_t mask = intern_cap - 1;
+    size_t i = hash_str(s, len) & mask;
+    while (intern_slots[i] &&
+           (strncmp(intern_slots[i], s, len) != 0 || intern_slots[i][len] != 0))
+        i = (i + 1) & mask;
+    return i;
 }
-// ---- Conditional Block Logic ----
-void cond_push(int val) {
-    if (cond_level + 1 < MAX_STACK)
-        cond_stack[++cond_level] = val && cond_stack[cond_level - 1];
-    if (DEBUG) DPRINTF("Pushed condition: %d (level %d)\n", val, cond_level);
+// Canonical copy of s[0..len), or NULL if it was never interned
+static const char *intern_find(const char *s, size_t len) {
+#ifndef _WIN32
+    if (intern_locked) {
+        pthread_rwlock_rdlock(&intern_lock);
+        const char *found = intern_cap ? intern_slots[intern_slot(s, len)] : NULL;
+        pthread_rwlock_unlock(&intern_lock);
+        return found;
+    }
+#endif
+    if (!intern_cap) return NULL;
+    return intern_slots[intern_slot(s, len)];
 }
-void cond_pop() {
-    if (cond_level > 0) {
-        if (DEBUG) DPRINTF("Popped condition (was level %d)\n", cond_level);
-        cond_level--;
+static const char *intern_insert(const char *s, size_t len) {
+    if ((intern_count + 1) * 2 > intern_cap) {
+        size_t old_cap = intern_cap;
+        const char **old = intern_slots;
+        intern_cap = old_cap ? old_cap * 2 : 256;
+        intern_slots = calloc(intern_cap, sizeof(char *));
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i]) intern_slots[intern_slot(old[i], strlen(old[i]))] = old[i];
+        free(old);
+    }
+    size_t i = intern_slot(s, len);
+    if (!intern_slots[i]) {
+        intern_slots[i] = arena_strndup(&intern_arena, s, len);
+        intern_count++;
     }
+    return intern_slots[i];
 }
-int cond_active() { return cond_stack[cond_level]; }
-
-// ---- Improved if() expression evaluator ----
-int eval_simple_if(char *expr) {
-    while (*expr == ' ' || *expr == '\t' || *expr == '\n') expr++;
-
-    char *or_parts[16];
-    int nor = 0;
-
-    char *save_or;
-    char *part = strtok_r(expr, "OR", &save_or);
-    while (part && nor < 16) {
-        or_parts[nor++] = part;
-        part = strtok_r(NULL, "OR", &save_or);
+static const char *intern_n(const char *s, size_t len) {
+#ifndef _WIN32
+    if (intern_locked) {
+        const char *found = intern_find(s, len);
+        if (found) return found;
+        pthread_rwlock_wrlock(&intern_lock);
+        found = intern_insert(s, len);
+        pthread_rwlock_unlock(&intern_lock);
+        return found;
     }
+#endif
+    return intern_insert(s, len);
+}
 
-    int or_result = 0;
-
-    for (int i = 0; i < nor; i++) {
-        char *p = or_parts[i];
-
-        char *and_parts[16];
-        int nand = 0;
-
-        char *save_and;
-        char *ap = strtok_r(p, "AND", &save_and);
-        while (ap && nand < 16) {
-            and_parts[nand++] = ap;
-            ap = strtok_r(NULL, "AND", &save_and);
-        }
-
-        int and_result = 1;
-
-        for (int j = 0; j < nand; j++) {
-            char *tok = and_parts[j];
-
-            while (*tok == ' ' || *tok == '\t') tok++;
-
-            int invert = 0;
-            if (strncmp(tok, "NOT ", 4) == 0) {
-                invert = 1;
-                tok += 4;
-            }
-
-            char var[128], op[128], val[128];
-            if (sscanf(tok, "%127s %127s %127s", var, op, val) == 3 &&
-                strcmp(op, "STREQUAL") == 0) {
-
-                int cmp = strcmp(getvar(var), val) == 0;
-                and_result &= invert ? !cmp : cmp;
-                continue;
-            }
-
-            const char *vval = getvar(tok);
-            int flag = (strcmp(vval, "ON") == 0 ||
-                        strcmp(vval, "1") == 0 ||
-                        (vval[0] && strcmp(vval, "OFF") != 0 && strcmp(vval, "0") != 0));
-
-            if (invert) flag = !flag;
+// ---- Name Index ----
+// Open-addressing map from an interned name to a table position. Keys are
+// compared by pointer, so a lookup never touches the name's characters.
+typedef struct {
+    const char **keys;
+    int *vals;
+    size_t cap, count;
+} NameIndex;
 
-            and_result &= flag;
+static size_t hash_ptr(const void *p) {
+    return (size_t)(((unsigned long long)(uintptr_t)p >> 3) * 11400714819323198485ULL);
+}
+static size_t name_index_slot(const NameIndex *ix, const char *key) {
+    size_t mask = ix->cap - 1;
+    size_t i = hash_ptr(key) & mask;
+    while (ix->keys[i] && ix->keys[i] != key) i = (i + 1) & mask;
+    return i;
+}
+// Position stored for key, or -1
+static int name_index_get(const NameIndex *ix, const char *key) {
+    if (!ix->cap || !key) return -1;
+    size_t i = name_index_slot(ix, key);
+    return ix->keys[i] ? ix->vals[i] : -1;
+}
+static void name_index_put(NameIndex *ix, const char *key, int val) {
+    if ((ix->count + 1) * 2 > ix->cap) {
+        NameIndex old = *ix;
+        ix->cap = old.cap ? old.cap * 2 : 256;
+        ix->keys = calloc(ix->cap, sizeof(char *));
+        ix->vals = malloc(ix->cap * sizeof(int));
+        for (size_t i = 0; i < old.cap; i++) {
+            if (!old.keys[i]) continue;
+            size_t j = name_index_slot(ix, old.keys[i]);
+            ix->keys[j] = old.keys[i];
+            ix->vals[j] = old.vals[i];
         }
-
-        or_result |= and_result;
+        free(old.keys);
+        free(old.vals);
     }
+    size_t i = name_index_slot(ix, key);
+    if (!ix->keys[i]) ix->count++;
+    ix->keys[i] = key;
+    ix->vals[i] = val;
+}
+static void name_index_clear(NameIndex *ix) {
+    if (ix->cap) memset(ix->keys, 0, ix->cap * sizeof(char *));
+    ix->count = 0;
+}
 
-    return or_result;
+// ---- Watch Records ----
+// --watch remembers what every directory added to the configure tables, so
+// that after a change only the directory it affects is configured again. A
+// directory is pinned once code outside it used what it defined or it changed
+// something outside itself; it is then configured again with its parent.
+enum { WATCH_DIRS, WATCH_TARGETS, WATCH_FUNCTIONS, WATCH_SCRIPTS, WATCH_GLOBS, WATCH_NTABLE };
+typedef struct {
+    const char *dir;            // as configure_directory() got it; NULL for the top
+    struct Scope *vars;         // the variables it started with, flattened
+    struct Scope *scope;        // its own, while it runs
+    int parent;                 // -1 for the top directory
+    int lo[WATCH_NTABLE];       // entries it and its subdirectories added
+    int hi[WATCH_NTABLE];
+    char active, pinned;
+} WatchDir;
+static int watching = 0;
+static THREAD_LOCAL WatchDir *watch_dirs = NULL;     // in the order they were entered
+static THREAD_LOCAL int nwatch_dir = 0;
+static THREAD_LOCAL int watch_cur = -1;             // the directory being configured
+
+// Whether directory d is root or one of its subdirectories
+static int watch_inside(int d, int root) {
+    while (d >= 0 && d != root) d = watch_dirs[d].parent;
+    return d == root;
+}
+// The current directory used something `owner` defined. Unless owner is
+// running, it and every parent up to the one that is are pinned.
+static void watch_touch(int owner) {
+    if (!watching || watch_cur < 0) return;
+    for (int d = owner; d >= 0 && !watch_dirs[d].active; d = watch_dirs[d].parent)
+        watch_dirs[d].pinned = 1;
+}
+// The current directory changed its parent's variables, or with `up` set
+// something every directory shares
+static void watch_pin(int up) {
+    if (!watching || watch_cur < 0) return;
+    for (int d = watch_cur; d >= 0; d = up ? watch_dirs[d].parent : -1) watch_dirs[d].pinned = 1;
 }
 
-// ---- Multi-line CMake Parser ----
-char *read_cmake_cmd(FILE *fi, char *buf, int buflen) {
-    char *out = buf;
-    int depth = 0, found = 0;
-    while (fgets(out, buflen - (out - buf), fi)) {
-        char *hash = strchr(out, '#');
-        if (hash) *hash = 0;
-        size_t l = strlen(out);
-        for (char *c = out; *c; ++c) {
-            if (*c == '(') depth++;
-            else if (*c == ')') depth--;
+// Every script read while watching, with what it held when it was read
+typedef struct {
+    const char *path;           // interned
+    long long mtime;            // taken before reading
+    unsigned long long hash;
+} WatchFile;
+static WatchFile *watch_files = NULL;
+static int nwatch_file = 0, watch_files_cap = 0;
+static NameIndex watch_file_index;
+
+static void watch_file_read(const char *path, long long mtime, const char *data, size_t size) {
+    const char *k = intern_n(path, strlen(path));
+    int idx = name_index_get(&watch_file_index, k);
+    if (idx < 0) {
+        if (nwatch_file == watch_files_cap) {
+            watch_files_cap = watch_files_cap ? watch_files_cap * 2 : 64;
+            watch_files = realloc(watch_files, watch_files_cap * sizeof(WatchFile));
         }
-        out += l;
-        if (strchr(buf, '(')) found = 1;
-        if (found && depth <= 0) break;
+        idx = nwatch_file++;
+        watch_files[idx].path = k;
+        name_index_put(&watch_file_index, k, idx);
     }
-    *out = 0;
-    char *start = buf;
-    while (*start == ' ' || *start == '\t' || *start == '\n') start++;
-    char *end = buf + strlen(buf) - 1;
-    while (end > start && (*end == '\n' || *end == ' ' || *end == '\t')) *end-- = 0;
-    if (!*start) return NULL;
-    memmove(buf, start, strlen(start) + 1);
-    if (DEBUG) DPRINTF("Read CMake command: [%s]\n", buf);
-    return buf;
+    watch_files[idx].mtime = mtime;
+    watch_files[idx].hash = hash_bytes(data, size, HASH_SEED);
+}
+// What hash_file() gave for the script when it was last read, or 0
+static unsigned long long watch_file_hash(const char *path) {
+    const char *k = intern_find(path, strlen(path));
+    int idx = watching ? name_index_get(&watch_file_index, k) : -1;
+    return idx >= 0 ? watch_files[idx].hash : 0;
 }
 
-// ---- Command Handlers ----
-void cmd_cmake_minimum_required(const char *args) {
-    DPRINTF("cmake_minimum_required: %s\n", args);
+// ---- Variable Table ----
+// Every directory and every function call gets a scope. A scope holds only
+// what was set in it and reads everything else through its parent, so entering
+// one copies nothing; writes land in the current scope and hide the parent's
+// value without changing it.
+typedef struct Scope {
+    struct Scope *parent;   // NULL for the top directory
+    Var *vars;              // in definition order
+    int nvars, cap;
+    NameIndex index;
+    int shared;             // read by configure threads, must not change
+} Scope;
+static Scope top_scope;
+static THREAD_LOCAL Scope *cur_scope = &top_scope;
+
+static void reset_vars(void) {
+    top_scope.nvars = 0;
+    name_index_clear(&top_scope.index);
 }
-void cmd_message(const char *args) {
-    trim_token((char*)args);
-    printf("%s\n", args);
+static void push_scope(Scope *s) {
+    memset(s, 0, sizeof *s);
+    s->parent = cur_scope;
+    cur_scope = s;
+}
+static void pop_scope(void) {
+    Scope *s = cur_scope;
+    cur_scope = s->parent;
+    free(s->vars);
+    free(s->index.keys);
+    free(s->index.vals);
 }
-void cmd_add_compile_options(const char *args) {
-    char filtered[1024] = "";
-    char *saveptr = NULL;
-
-    for (char *tok = strtok_r((char*)args, " ", &saveptr);
-         tok;
-         tok = strtok_r(NULL, " ", &saveptr)) {
 
-#ifndef _WIN32
-        // Skip MSVC-style flags on Unix
-        if (tok[0] == '/' && tok[1] != '\0')
-            continue;
-#endif
+static int value_defined(const Value *v) { return v->str || v->items; }
 
-        strcat(filtered, tok);
-        strcat(filtered, " ");
+static Var *scope_var(const Scope *s, const char *key) {
+    int idx = name_index_get(&s->index, key);
+    return idx >= 0 ? &s->vars[idx] : NULL;
+}
+// The value visible under key, or NULL if it is undefined
+static Value *find_value(const char *key, size_t len) {
+    if (prof.enabled) prof.getvar_calls++;
+    const char *k = intern_find(key, len);
+    if (!k) return NULL;
+    for (Scope *s = cur_scope; s; s = s->parent) {
+        Var *v = scope_var(s, k);
+        if (v) return value_defined(&v->val) ? &v->val : NULL;
     }
-
-    char buf[1024];
-    snprintf(buf, sizeof(buf), "%s %s", getvar("CMAKE_C_FLAGS"), filtered);
-    setvar("CMAKE_C_FLAGS", buf);
+    return NULL;
 }
-
-void cmd_set(const char *args) {
-    char key[128], val[768] = "";
-    if (sscanf(args, "%127s %767[^\n\r)]", key, val) >= 1) {
-        trim_token(key);
-        trim_token(val);
-
-        // --- FILTER CMAKE_C_FLAGS ON NON-WINDOWS ---
-        if (strcmp(key, "CMAKE_C_FLAGS") == 0) {
-#ifndef _WIN32
-            char filtered[1024] = "";
-            char tmp[1024];
-            strncpy(tmp, val, sizeof(tmp));
-            tmp[sizeof(tmp)-1] = 0;
-
-            char *saveptr = NULL;
-            for (char *tok = strtok_r(tmp, " ", &saveptr);
-                 tok;
-                 tok = strtok_r(NULL, " ", &saveptr)) {
-                if (tok[0] == '/' && tok[1] != '\0')
-                    continue;
-
-                strcat(filtered, tok);
-                strcat(filtered, " ");
-            }
-
-            setvar(key, filtered);
-            return;
-#endif
+static const char *value_str(Value *v) {
+    if (!v->str) {
+        size_t len = 0;
+        for (int i = 0; i < v->nitem; i++) len += strlen(v->items[i]) + 1;
+        char *p = v->str = arena_alloc(&config_arena, len + 1);
+        for (int i = 0; i < v->nitem; i++) {
+            if (i) *p++ = ';';
+            size_t n = strlen(v->items[i]);
+            memcpy(p, v->items[i], n);
+            p += n;
         }
-
-        setvar(key, val);
+        *p = 0;
     }
+    return v->str;
+}
+const char *getvar_n(const char *key, size_t len) {
+    Value *v = find_value(key, len);
+    return v ? value_str(v) : "";
+}
+const char *getvar(const char *key) {
+    return getvar_n(key, strlen(key));
+}
+static int var_defined(const char *key) {
+    return find_value(key, strlen(key)) != NULL;
 }
 
-void cmd_add_definitions(const char *args) {
-    char def[256];
-
-    sscanf(args, "%255s", def);
-    trim_token(def);
-
-    for (int i = 0; i < ntarget; i++) {
-        add_string(&targets[i].defs, &targets[i].ndef, def);
+// A variable used as command-line text: list elements separated by spaces,
+// in the scratch arena
+static const char *getvar_command(const char *key) {
+    Value *v = find_value(key, strlen(key));
+    if (!v) return "";
+    if (!v->items) return v->str;
+    size_t len = 0;
+    for (int i = 0; i < v->nitem; i++) len += strlen(v->items[i]) + 1;
+    char *out = arena_alloc(&scratch_arena, len + 1), *p = out;
+    for (int i = 0; i < v->nitem; i++) {
+        if (i) *p++ = ' ';
+        size_t n = strlen(v->items[i]);
+        memcpy(p, v->items[i], n);
+        p += n;
     }
-
-    if (DEBUG) DPRINTF("add_definitions to all targets: %s\n", def);
+    *p = 0;
+    return out;
 }
-void cmd_add_library(const char *args) {
-    char name[128], type[64];
-
-    char *rest = malloc(65536);
-    if (!rest) return;
-    rest[0] = '\0';
-
-    sscanf(args, "%127s %63s %65535[^\n\r)]", name, type, rest);
 
-    trim_token(name);
-    trim_token(type);
-
-    Target *t = &targets[ntarget++];
-    strcpy(t->name, name);
-
-    if (strcasecmp(type, "STATIC") == 0) {
-        strcpy(t->type, "STATIC");
-    } else if (strcasecmp(type, "SHARED") == 0) {
-        strcpy(t->type, "SHARED");
-    } else {
-        strcpy(t->type, "EXE");
+// Stores a value (an empty Value unsets) under an interned key
+static void scope_put(Scope *s, const char *k, Value val) {
+    Var *v = scope_var(s, k);
+    if (v) {
+        v->val = val;
+        return;
     }
+    // Below the top an undefined value is kept, it hides the parent's
+    if (!value_defined(&val) && !s->parent) return;
 
-    t->srcs = NULL;
-    t->nsrc = 0;
-    t->defs = NULL;
-    t->ndef = 0;
-    t->incs = NULL;
-    t->ninc = 0;
-    t->libs = NULL;
-    t->nlib = 0;
-
-    char *saveptr = NULL;
-    char *tok = strtok_r(rest, " ", &saveptr);
-
-    while (tok) {
-        trim_token(tok);
-        if (*tok) {
-            t->srcs = realloc(t->srcs, (t->nsrc + 1) * sizeof(char *));
-            t->srcs[t->nsrc] = strdup(tok);
-            t->nsrc++;
-        }
-        tok = strtok_r(NULL, " ", &saveptr);
+    if (s->nvars == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 16;
+        s->vars = realloc(s->vars, s->cap * sizeof(Var));
     }
-
-    DPRINTF("add_library: %s type %s [%d srcs]\n",
-            t->name, t->type, t->nsrc);
-
-    free(rest);
+    s->vars[s->nvars].key = k;
+    s->vars[s->nvars].val = val;
+    name_index_put(&s->index, k, s->nvars);
+    s->nvars++;
 }
-void cmd_add_executable(const char *args) {
-    char name[128];
-
-    char *rest = malloc(65536);
-    rest[0] = '\0';
-
-    sscanf(args, "%127s %65535[^\n\r)]", name, rest);
-    trim_token(name);
-
-    Target *t = &targets[ntarget++];
-    strcpy(t->name, name);
-    strcpy(t->type, "EXE");
-
-    t->srcs = NULL; t->nsrc = 0;
-    t->defs = NULL; t->ndef = 0;
-    t->incs = NULL; t->ninc = 0;
-    t->libs = NULL; t->nlib = 0;
-
-    char *saveptr = NULL;
-    char *tok = strtok_r(rest, " ", &saveptr);
-
-    while (tok) {
-        trim_token(tok);
-        if (*tok)
-            add_string(&t->srcs, &t->nsrc, tok);
-        tok = strtok_r(NULL, " ", &saveptr);
-    }
-
-    DPRINTF("add_executable: %s [%d srcs]\n", name, t->nsrc);
-    free(rest);
+static void store_var(const char *k, Value val) {
+    scope_put(cur_scope, k, val);
 }
-void cmd_include(const char *args) {
-    char fname[256];
-    sscanf(args, "%255s", fname);
-
-    char *f = fname;
-    while (*f == '"' || *f == '\'') f++;
-
-    char *quote = strrchr(f, '"');
-    if (quote) *quote = 0;
-
-    if (DEBUG) DPRINTF("include: %s\n", f);
-
-    FILE *inc = fopen(f, "r");
-    if (!inc) {
-        DPRINTF("include failed: %s not found\n", f);
+static Value string_value(const char *str) {
+    Value v = { arena_strdup(&config_arena, str), NULL, 0 };
+    return v;
+}
+// A list of already interned elements. The array is sized the way
+// arena_grow() expects, so list(APPEND) can add to it in place.
+static Value list_copy(int n, const char **items) {
+    if (n == 0) return string_value("");
+    size_t cap = 4;
+    while (cap < (size_t)n) cap *= 2;
+    Value v = { NULL, arena_alloc(&config_arena, cap * sizeof(char *)), n };
+    memcpy(v.items, items, n * sizeof(char *));
+    return v;
+}
+// A copy of v to store again later. A list gets an array of its own, since
+// only the scope that owns an array may append to it in place.
+static Value saved_value(const Value *v) {
+    static const Value undefined;
+    if (!v) return undefined;
+    return v->items ? list_copy(v->nitem, v->items) : *v;
+}
+// The elements interned into a list; no elements gives the empty string
+static Value list_value(int n, char **items) {
+    Value v = list_copy(n, (const char **)items);
+    for (int i = 0; v.items && i < n; i++) v.items[i] = intern_n(items[i], strlen(items[i]));
+    return v;
+}
+void setvar(const char *key, const char *val) {
+    store_var(intern_n(key, strlen(key)), string_value(val));
+}
+static void setvar_list(const char *key, int n, char **items) {
+    store_var(intern_n(key, strlen(key)), list_value(n, items));
+}
+static void setvar_value(const char *key, Value val) {
+    store_var(intern_n(key, strlen(key)), val);
+}
+static void unsetvar(const char *key) {
+    static const Value undefined;
+    const char *k = intern_find(key, strlen(key));
+    if (k) store_var(k, undefined);
+}
+static void run_serially(void);
+// set(... PARENT_SCOPE): the current scope keeps the value it sees now
+static void set_parent_scope(const char *key, Value val) {
+    Scope *s = cur_scope;
+    if (!s->parent) {           // the top directory has no parent
+        setvar_value(key, val);
         return;
     }
-
-    char cmdline[MAX_LINE * 4];
-    while (read_cmake_cmd(inc, cmdline, sizeof cmdline)) {
-        char expcmd[MAX_LINE * 4];
-        expand_vars(cmdline, expcmd, sizeof expcmd);
-
-        char *p = expcmd;
-
-        if (strncmp(p, "set(", 4) == 0)
-            cmd_set(p + 4);
-        else if (strncmp(p, "add_executable(", 15) == 0)
-            cmd_add_executable(p + 15);
-        else if (strncmp(p, "add_library(", 12) == 0)
-            cmd_add_library(p + 12);
-        else if (strncmp(p, "add_definitions(", 16) == 0)
-            cmd_add_definitions(p + 16);
-        else if (DEBUG)
-            DPRINTF("include: unknown command '%s'\n", p);
+    // The parent directory of a subdirectory running on a configure thread
+    // is shared with its siblings
+    if (s->parent->shared) {
+        run_serially();
+        return;
     }
-
-    fclose(inc);
+    if (watching && watch_cur >= 0 && s == watch_dirs[watch_cur].scope) watch_pin(0);
+    const char *k = intern_n(key, strlen(key));
+    if (!scope_var(s, k)) scope_put(s, k, saved_value(find_value(key, strlen(key))));
+    scope_put(s->parent, k, val);
 }
-void cmd_add_subdirectory(const char *args) {
-    char dir[256];
-    sscanf(args, "%255s", dir);
-
-    char fname[512];
-    snprintf(fname, sizeof(fname), "%s/CMakeLists.txt", dir);
-
-    cmd_include(fname);
+// ---- Target Lookup ----
+static THREAD_LOCAL NameIndex target_index;
+typedef struct SubdirJob SubdirJob;
+static THREAD_LOCAL SubdirJob *subdir_job;     // set on configure threads
+static Target *outer_target(const char *name);
+
+static Target *find_target(const char *name) {
+    int idx = name_index_get(&target_index, intern_find(name, strlen(name)));
+    if (idx < 0) return outer_target(name);
+    watch_touch(targets[idx].dir);
+    return &targets[idx];
 }
-static void parse_and_add_includes(const char *rest, char ***incs, int *nincs) {
-    char buf[4096];
-    strncpy(buf, rest, sizeof(buf)-1);
-    buf[sizeof(buf)-1] = 0;
-
-    trim_token(buf);
-
-    char *saveptr = NULL;
-    char *dir = strtok_r(buf, " ", &saveptr);
-
-    while (dir) {
-        trim_token(dir);
-        if (*dir)
-            add_string(incs, nincs, dir);
-        dir = strtok_r(NULL, " ", &saveptr);
+// A target a command is about to change. A configure thread only changes
+// its own; one defined before its batch makes the subdirectory run serially.
+static Target *modify_target(const char *name) {
+    int idx = name_index_get(&target_index, intern_find(name, strlen(name)));
+    if (idx >= 0) {
+        watch_touch(targets[idx].dir);
+        return &targets[idx];
     }
+    if (outer_target(name)) run_serially();
+    return NULL;
 }
-void cmd_include_directories_global(const char *args) {
-    char rest[4096];
-
-    if (sscanf(args, "%4095[^\n\r)]", rest) != 1)
-        return;
-
-    parse_and_add_includes(rest, &global_incs, &nglobal_incs);
-
-    DPRINTF("include_directories (global): %s\n", rest);
+// Appends a target; the table grows by doubling, so Target pointers are
+// only valid until the next new_target()
+static Target *new_target(const char *name, const char *type) {
+    if (ntarget == targets_cap) {
+        targets_cap = targets_cap ? targets_cap * 2 : 64;
+        targets = realloc(targets, targets_cap * sizeof(Target));
+    }
+    Target *t = &targets[ntarget];
+    memset(t, 0, sizeof *t);
+    t->name = intern_n(name, strlen(name));
+    snprintf(t->type, sizeof t->type, "%s", type);
+    t->dir = watch_cur;
+    name_index_put(&target_index, t->name, ntarget);
+    ntarget++;
+    return t;
+}
+static void reset_targets(void) {
+    ntarget = 0;
+    name_index_clear(&target_index);
 }
-void cmd_include_dirs(const char *args) {
-    char tname[128], scope[32], rest[4096];
-
-    if (sscanf(args, "%127s %31s %[^\n\r)]", tname, scope, rest) != 3)
-        return;
-
-    trim_token(tname);
-    trim_token(scope);
-    trim_token(rest);
 
-    for (int i = 0; i < ntarget; i++) {
-        if (strcmp(targets[i].name, tname) == 0) {
-            parse_and_add_includes(rest, &targets[i].incs, &targets[i].ninc);
+// NULL if the property was never set
+static const char *target_prop(const Target *t, const char *key) {
+    for (int i = 0; i + 1 < t->nprop; i += 2)
+        if (strcmp(t->props[i], key) == 0) return t->props[i + 1];
+    return NULL;
+}
+static void set_target_prop(Target *t, const char *key, const char *val) {
+    for (int i = 0; i + 1 < t->nprop; i += 2)
+        if (strcmp(t->props[i], key) == 0) {
+            t->props[i + 1] = arena_strdup(&config_arena, val);
+            return;
         }
+    add_string(&t->props, &t->nprop, key);
+    add_string(&t->props, &t->nprop, val);
+}
+// Properties a new target takes from CMAKE_<PROP> variables, as in CMake
+static const char *const inherited_props[] = {
+    "UNITY_BUILD", "UNITY_BUILD_BATCH_SIZE", "INTERPROCEDURAL_OPTIMIZATION",
+};
+static void init_target_props(Target *t) {
+    char var[64];
+    for (size_t i = 0; i < sizeof inherited_props / sizeof inherited_props[0]; i++) {
+        snprintf(var, sizeof var, "CMAKE_%s", inherited_props[i]);
+        const char *val = getvar(var);
+        if (*val) set_target_prop(t, inherited_props[i], val);
     }
-
-    DPRINTF("target_include_directories: %s %s\n", tname, scope);
 }
-void cmd_target_link_libs(const char *args) {
-    char tname[128];
-    char libs[4096] = {0};
 
-    DPRINTF("RAW args = '%s'\n", args);
-
-    while (*args == '(' || isspace(*args))
-        args++;
-
-    char cleaned[4096];
-    strncpy(cleaned, args, sizeof(cleaned));
-    cleaned[sizeof(cleaned)-1] = 0;
-
-    char *end = cleaned + strlen(cleaned) - 1;
-    while (end >= cleaned && (*end == ')' || isspace(*end))) {
-        *end = 0;
-        end--;
-    }
+// ---- Source Properties ----
+// set_source_files_properties() values, keyed by the source's absolute path
+typedef struct {
+    const char *path;   // interned
+    char **props;       // key, value pairs
+    int nprop;
+} SourceProps;
+static THREAD_LOCAL SourceProps *source_props = NULL;
+static THREAD_LOCAL int nsource_props = 0;
+static THREAD_LOCAL NameIndex source_index;
+
+static const char *source_key(const char *path) {
+    const char *top = getvar("CMAKE_SOURCE_DIR");
+    if (path[0] == '/' || (path[0] && path[1] == ':') || !*top) return intern_n(path, strlen(path));
+    size_t tlen = strlen(top), plen = strlen(path);
+    char *abs = arena_alloc(&scratch_arena, tlen + plen + 2);
+    memcpy(abs, top, tlen);
+    abs[tlen] = '/';
+    memcpy(abs + tlen + 1, path, plen + 1);
+    return intern_n(abs, tlen + plen + 1);
+}
+static SourceProps *find_source_props(const char *path, int create) {
+    const char *k = source_key(path);
+    int idx = name_index_get(&source_index, k);
+    if (idx >= 0) return &source_props[idx];
+    if (!create) return NULL;
+    source_props = arena_grow(&config_arena, source_props, nsource_props, sizeof(SourceProps));
+    SourceProps *s = &source_props[nsource_props];
+    memset(s, 0, sizeof *s);
+    s->path = k;
+    name_index_put(&source_index, k, nsource_props++);
+    return s;
+}
+static const char *source_prop(const char *path, const char *key) {
+    const SourceProps *s = find_source_props(path, 0);
+    for (int i = 0; s && i + 1 < s->nprop; i += 2)
+        if (strcmp(s->props[i], key) == 0) return s->props[i + 1];
+    return NULL;
+}
+static void set_source_prop(const char *path, const char *key, const char *val) {
+    watch_pin(1);
+    SourceProps *s = find_source_props(path, 1);
+    for (int i = 0; i + 1 < s->nprop; i += 2)
+        if (strcmp(s->props[i], key) == 0) {
+            s->props[i + 1] = arena_strdup(&config_arena, val);
+            return;
+        }
+    add_string(&s->props, &s->nprop, key);
+    add_string(&s->props, &s->nprop, val);
+}
+
+// ---- Script Tokenizer ----
+// Each script is mapped into memory and split into commands in one linear
+// pass. Tokens point into the mapping; escapes and ${} are only processed
+// when a command runs.
+enum { ARG_UNQUOTED, ARG_QUOTED, ARG_BRACKET };
+
+typedef struct {
+    const char *text;
+    size_t len;
+    int kind;
+} Token;
+
+// Block commands are linked when a script is loaded; everything else is
+// looked up by its lowercased, interned name
+enum {
+    OP_CALL = -1,       // a function() or macro(), found at run time
+    OP_IF, OP_ELSEIF, OP_ELSE, OP_ENDIF, OP_FOREACH, OP_ENDFOREACH, OP_WHILE, OP_ENDWHILE,
+    OP_FUNCTION, OP_ENDFUNCTION, OP_MACRO, OP_ENDMACRO, OP_BREAK, OP_CONTINUE, OP_RETURN,
+    OP_BUILTIN          // first entry of builtin_commands[]
+};
+
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *id;     // lowercase, interned
+    int op;             // OP_*
+    int next;           // if/elseif/else: the next branch of the chain
+    int end;            // block commands: the closing endif/endforeach/...
+    int line;
+    Token *args;
+    int nargs;
+} Command;
+
+typedef struct {
+    const char *path;
+    const char *data;
+    size_t size;
+    Command *cmds;
+    int ncmd;
+} Script;
+
+static THREAD_LOCAL int configure_error = 0;
+
+static void script_error(const Script *s, int line, const char *msg) {
+    fprintf(message_out(), "Parse error at %s:%d: %s\n", s->path, line, msg);
+    configure_error = 1;
+}
+
+// Number of '=' in a bracket opener "[==[" at p, or -1 if there is none
+static int bracket_open(const char *p, const char *end) {
+    if (p >= end || *p != '[') return -1;
+    const char *q = p + 1;
+    while (q < end && *q == '=') q++;
+    return (q < end && *q == '[') ? (int)(q - p - 1) : -1;
+}
+// The closing "]==]" matching an opener with `eq` '=' signs, or NULL
+static const char *bracket_close(const char *p, const char *end, int eq) {
+    for (; p < end; p++) {
+        if (*p != ']') continue;
+        const char *q = p + 1;
+        while (q < end && *q == '=') q++;
+        if (q - p - 1 == eq && q < end && *q == ']') return p;
+    }
+    return NULL;
+}
+static int count_lines(const char *p, const char *end) {
+    int n = 0;
+    for (; p < end; p++) n += *p == '\n';
+    return n;
+}
+// Skips a "# line" or "#[[bracket]]" comment starting at p
+static const char *skip_comment(const Script *s, const char *p, const char *end, int *line) {
+    int eq = bracket_open(p + 1, end);
+    if (eq >= 0) {
+        const char *close = bracket_close(p + eq + 3, end, eq);
+        if (!close) { script_error(s, *line, "unterminated bracket comment"); return end; }
+        *line += count_lines(p, close);
+        return close + eq + 2;
+    }
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+static void add_token(Command *c, const char *text, size_t len, int kind) {
+    c->args = arena_grow(&config_arena, c->args, c->nargs, sizeof(Token));
+    c->args[c->nargs].text = text;
+    c->args[c->nargs].len = len;
+    c->args[c->nargs].kind = kind;
+    c->nargs++;
+}
+
+static int tokenize_script(Script *s) {
+    const char *p = s->data, *end = s->data + s->size;
+    int line = 1;
+    while (p < end) {
+        char c = *p;
+        if (c == '\n') { line++; p++; continue; }
+        if (c == ' ' || c == '\t' || c == '\r') { p++; continue; }
+        if (c == '#') { p = skip_comment(s, p, end, &line); continue; }
+        if (!isalpha((unsigned char)c) && c != '_') {
+            script_error(s, line, "expected a command name");
+            return 0;
+        }
+
+        Command cmd = {0};
+        cmd.name = p;
+        cmd.line = line;
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+        cmd.name_len = p - cmd.name;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p >= end || *p != '(') {
+            script_error(s, line, "expected '(' after command name");
+            return 0;
+        }
+        p++;
+
+        // Arguments up to the matching ')'; nested parens become tokens of their own
+        int depth = 0;
+        for (;;) {
+            if (p >= end) {
+                script_error(s, cmd.line, "missing ')' at end of command");
+                return 0;
+            }
+            c = *p;
+            if (c == '\n') { line++; p++; }
+            else if (c == ' ' || c == '\t' || c == '\r') p++;
+            else if (c == '#') p = skip_comment(s, p, end, &line);
+            else if (c == '(') { depth++; add_token(&cmd, p, 1, ARG_UNQUOTED); p++; }
+            else if (c == ')') {
+                p++;
+                if (depth-- == 0) break;
+                add_token(&cmd, p - 1, 1, ARG_UNQUOTED);
+            } else if (c == '"') {
+                int start_line = line;
+                const char *start = ++p;
+                while (p < end && *p != '"') {
+                    if (*p == '\\' && p + 1 < end) p++;
+                    if (*p == '\n') line++;
+                    p++;
+                }
+                if (p >= end) {
+                    script_error(s, start_line, "unterminated quoted argument");
+                    return 0;
+                }
+                add_token(&cmd, start, p - start, ARG_QUOTED);
+                p++;
+            } else if (bracket_open(p, end) >= 0) {
+                int eq = bracket_open(p, end);
+                const char *start = p + eq + 2;
+                const char *close = bracket_close(start, end, eq);
+                if (!close) {
+                    script_error(s, line, "unterminated bracket argument");
+                    return 0;
+                }
+                line += count_lines(start, close);
+                if (start < close && *start == '\n') start++;
+                else if (close - start >= 2 && start[0] == '\r' && start[1] == '\n') start += 2;
+                add_token(&cmd, start, close - start, ARG_BRACKET);
+                p = close + eq + 2;
+            } else {
+                const char *start = p;
+                while (p < end) {
+                    c = *p;
+                    if (c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+                        c == '(' || c == ')' || c == '#')
+                        break;
+                    if (c == '\\' && p + 1 < end) { p += 2; continue; }
+                    if (c == '"') {
+                        // Legacy -DX="a b" style quotes inside an unquoted argument
+                        p++;
+                        while (p < end && *p != '"' && *p != '\n') p++;
+                        if (p < end && *p == '"') p++;
+                        continue;
+                    }
+                    p++;
+                }
+                add_token(&cmd, start, p - start, ARG_UNQUOTED);
+            }
+        }
+
+        s->cmds = arena_grow(&config_arena, s->cmds, s->ncmd, sizeof(Command));
+        s->cmds[s->ncmd++] = cmd;
+    }
+    return 1;
+}
+
+static int compile_script(Script *s);
+
+// Maps and tokenizes a script; NULL if it cannot be read or parsed.
+// The mapping stays alive for the whole run since tokens point into it.
+// --watch reads scripts into the arena instead: a file edited later must not
+// change under the tokens, and the memory is reused by the next configure.
+static Script *load_script(const char *path) {
+    Script *s = arena_alloc(&config_arena, sizeof(Script));
+    memset(s, 0, sizeof *s);
+    s->path = arena_strdup(&config_arena, path);
+    int mapped = 0;
+#ifndef _WIN32
+    if (!watching) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { close(fd); return NULL; }
+        s->size = (size_t)st.st_size;
+        s->data = "";
+        if (s->size) {
+            void *map = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) { close(fd); return NULL; }
+            s->data = map;
+        }
+        close(fd);
+        mapped = 1;
+    }
+#endif
+    if (!mapped) {
+        long long mtime = watching ? file_mtime(path) : 0;
+        FILE *f = fopen(path, "rb");
+        if (!f) return NULL;
+        fseek(f, 0, SEEK_END);
+        s->size = (size_t)ftell(f);
+        rewind(f);
+        char *buf = arena_alloc(&config_arena, s->size + 1);
+        s->size = fread(buf, 1, s->size, f);
+        fclose(f);
+        s->data = buf;
+        if (watching) watch_file_read(path, mtime, buf, s->size);
+    }
+    add_string(&script_files, &nscript_files, path);
+    if (!tokenize_script(s) || !compile_script(s)) return NULL;
+    DPRINTF("Read %s: %d commands\n", path, s->ncmd);
+    return s;
+}
+
+// ---- Variable Expansion ----
+// Growable string in the scratch arena, used to build expanded arguments
+typedef struct {
+    char *data;
+    size_t len, cap;
+} StrBuf;
+
+static void sb_putn(StrBuf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        while (cap < b->len + n + 1) cap *= 2;
+        char *bigger = arena_alloc(&scratch_arena, cap);
+        if (b->len) memcpy(bigger, b->data, b->len);
+        b->data = bigger;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = 0;
+}
+static void sb_putc(StrBuf *b, char c) { sb_putn(b, &c, 1); }
+static void sb_puts(StrBuf *b, const char *s) { sb_putn(b, s, strlen(s)); }
+static const char *sb_str(StrBuf *b) { return b->data ? b->data : ""; }
+
+static void expand_text(StrBuf *out, const char **pp, const char *end, int escapes, char stop);
+
+// Expands the reference at *pp ("${NAME}" or "$ENV{NAME}"); NAME may itself
+// contain references. Returns 0 if *pp does not start a complete reference.
+static int expand_ref(StrBuf *out, const char **pp, const char *end) {
+    const char *p = *pp;
+    int env = 0;
+    if (end - p >= 5 && strncmp(p, "$ENV{", 5) == 0) { env = 1; p += 5; }
+    else if (end - p >= 2 && p[0] == '$' && p[1] == '{') p += 2;
+    else return 0;
+
+    StrBuf name = {0};
+    expand_text(&name, &p, end, 0, '}');
+    if (p >= end || *p != '}') return 0;
+
+    const char *val;
+    if (env) {
+        val = getenv(sb_str(&name));
+        if (!val) val = "";
+    } else {
+        val = getvar_n(sb_str(&name), name.len);
+    }
+    TPRINTF("Expanding variable: ${%s} -> %s\n", sb_str(&name), val);
+    size_t len = strlen(val);
+    sb_putn(out, val, len);
+    if (prof.enabled) prof.expanded_bytes += len;
+    *pp = p + 1;
+    return 1;
+}
+// Copies text up to `end` (or an unnested `stop` character) into out,
+// replacing variable references and, if asked, escape sequences
+static void expand_text(StrBuf *out, const char **pp, const char *end, int escapes, char stop) {
+    const char *p = *pp;
+    while (p < end && (!stop || *p != stop)) {
+        if (*p == '$' && expand_ref(out, &p, end)) continue;
+        if (escapes && *p == '\\' && p + 1 < end) {
+            char c = p[1];
+            p += 2;
+            if (c == 'n') sb_putc(out, '\n');
+            else if (c == 't') sb_putc(out, '\t');
+            else if (c == 'r') sb_putc(out, '\r');
+            else if (c == '\n') {}  // line continuation inside quotes
+            else sb_putc(out, c);
+            continue;
+        }
+        sb_putc(out, *p++);
+    }
+    *pp = p;
+}
+
+// Splits s in place into list elements on ';', dropping empty ones, and
+// appends them to the scratch array argv
+static int split_list(char *s, char ***argv, int argc) {
+    while (s && *s) {
+        while (*s == ';') s++;
+        if (!*s) break;
+        char *e = s;
+        while (*e && *e != ';') e++;
+        *argv = arena_grow(&scratch_arena, *argv, argc, sizeof(char *));
+        (*argv)[argc++] = s;
+        if (!*e) break;
+        *e = 0;
+        s = e + 1;
+    }
+    return argc;
+}
+// Appends the elements of the variable named `name` to the scratch array
+// items: a list's as they are, a string's split on ';'
+static int list_items(const char *name, char ***items, int n) {
+    Value *v = find_value(name, strlen(name));
+    if (!v) return n;
+    if (!v->items) return split_list(arena_strdup(&scratch_arena, v->str), items, n);
+    for (int i = 0; i < v->nitem; i++) {
+        if (!*v->items[i]) continue;
+        *items = arena_grow(&scratch_arena, *items, n, sizeof(char *));
+        (*items)[n++] = (char *)v->items[i];
+    }
+    return n;
+}
+// Expands a command's arguments into a NULL-terminated argv in the scratch
+// arena. The tokenizer already separated arguments on whitespace; unquoted
+// ones are split into list elements on ';', quoted and bracket ones stay
+// whole. Handlers must not write to argv strings, which may be a list
+// variable's elements.
+static int expand_command(const Command *c, char ***argv_out) {
+    char **argv = NULL;
+    int argc = 0;
+    for (int i = 0; i < c->nargs; i++) {
+        const Token *tok = &c->args[i];
+        const char *p = tok->text, *end = tok->text + tok->len;
+        // An unquoted ${LIST} passes the list's elements on without copying
+        if (tok->kind == ARG_UNQUOTED && tok->len > 3 && p[0] == '$' && p[1] == '{' && end[-1] == '}' &&
+            !memchr(p + 2, '$', tok->len - 3) && !memchr(p + 2, '}', tok->len - 3)) {
+            Value *v = find_value(p + 2, tok->len - 3);
+            if (v && v->items) {
+                for (int j = 0; j < v->nitem; j++) {
+                    if (!*v->items[j]) continue;
+                    argv = arena_grow(&scratch_arena, argv, argc, sizeof(char *));
+                    argv[argc++] = (char *)v->items[j];
+                }
+                continue;
+            }
+        }
+        StrBuf val = {0};
+        if (tok->kind == ARG_BRACKET) sb_putn(&val, p, tok->len);
+        else expand_text(&val, &p, end, 1, 0);
+
+        if (tok->kind != ARG_UNQUOTED) {
+            argv = arena_grow(&scratch_arena, argv, argc, sizeof(char *));
+            argv[argc++] = val.data ? val.data : arena_strdup(&scratch_arena, "");
+            continue;
+        }
+        argc = split_list(val.data, &argv, argc);
+    }
+    argv = arena_grow(&scratch_arena, argv, argc, sizeof(char *));
+    argv[argc] = NULL;
+    *argv_out = argv;
+    return argc;
+}
+// Joins argv[0..argc) with `sep` into a scratch string
+static char *join_args(int argc, char **argv, const char *sep) {
+    StrBuf b = {0};
+    for (int i = 0; i < argc; i++) {
+        if (i) sb_puts(&b, sep);
+        sb_puts(&b, argv[i]);
+    }
+    return b.data ? b.data : arena_strdup(&scratch_arena, "");
+}
+
+// ---- Condition Evaluator ----
+// if(), elseif() and while() arguments, parsed with CMake's precedence:
+// parentheses, unary tests, binary tests, NOT, AND, OR.
+typedef struct {
+    char **argv;
+    int argc, pos;
+} CondParser;
+
+static int command_exists(const char *name);
+
+static int is_false_constant(const char *s) {
+    static const char *const names[] = { "", "0", "OFF", "NO", "FALSE", "N", "IGNORE", "NOTFOUND" };
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+        if (strcasecmp(s, names[i]) == 0) return 1;
+    size_t len = strlen(s);
+    return len >= 9 && strcasecmp(s + len - 9, "-NOTFOUND") == 0;
+}
+static int is_true_constant(const char *s) {
+    static const char *const names[] = { "1", "ON", "YES", "TRUE", "Y" };
+    for (size_t i = 0; i < sizeof names / sizeof names[0]; i++)
+        if (strcasecmp(s, names[i]) == 0) return 1;
+    return 0;
+}
+// 1 and sets *val if all of s is a number
+static int parse_number(const char *s, double *val) {
+    char *end;
+    if (!*s) return 0;
+    *val = strtod(s, &end);
+    return *end == 0;
+}
+// A lone argument: a constant, or else the variable it names
+static int cond_truth(const char *arg) {
+    double num;
+    if (is_true_constant(arg)) return 1;
+    if (parse_number(arg, &num)) return num != 0;
+    if (is_false_constant(arg)) return 0;
+    return var_defined(arg) && !is_false_constant(getvar(arg));
+}
+// An operand of a binary test is replaced by the variable it names, if any
+static const char *cond_operand(const char *arg) {
+    return var_defined(arg) ? getvar(arg) : arg;
+}
+// <0, 0, >0 comparing dotted versions component by component
+static int compare_versions(const char *a, const char *b) {
+    while (*a || *b) {
+        char *ea, *eb;
+        long x = strtol(a, &ea, 10), y = strtol(b, &eb, 10);
+        if (x != y) return x < y ? -1 : 1;
+        if ((*ea && *ea != '.') || (*eb && *eb != '.')) break;
+        a = *ea ? ea + 1 : ea;
+        b = *eb ? eb + 1 : eb;
+    }
+    return 0;
+}
+static int cond_matches(const char *text, const char *pattern) {
+#ifndef _WIN32
+    regex_t re;
+    regmatch_t m[10];
+    if (regcomp(&re, pattern, REG_EXTENDED) != 0) return 0;
+    int ok = regexec(&re, text, 10, m, 0) == 0;
+    for (int i = 0; ok && i < 10 && m[i].rm_so >= 0; i++) {
+        char name[16];
+        snprintf(name, sizeof name, "CMAKE_MATCH_%d", i);
+        StrBuf b = {0};
+        sb_putn(&b, text + m[i].rm_so, m[i].rm_eo - m[i].rm_so);
+        setvar(name, sb_str(&b));
+    }
+    regfree(&re);
+    return ok;
+#else
+    return strstr(text, pattern) != NULL;
+#endif
+}
+static int is_binary_test(const char *s) {
+    static const char *const ops[] = {
+        "STREQUAL", "STRLESS", "STRGREATER", "STRLESS_EQUAL", "STRGREATER_EQUAL",
+        "EQUAL", "LESS", "GREATER", "LESS_EQUAL", "GREATER_EQUAL", "MATCHES", "IN_LIST",
+        "VERSION_EQUAL", "VERSION_LESS", "VERSION_GREATER", "VERSION_LESS_EQUAL", "VERSION_GREATER_EQUAL",
+    };
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++)
+        if (strcmp(s, ops[i]) == 0) return 1;
+    return 0;
+}
+static int cond_binary(const char *lhs, const char *op, const char *rhs) {
+    if (strcmp(op, "IN_LIST") == 0) {
+        char **items = NULL;
+        int n = list_items(rhs, &items, 0);
+        for (int i = 0; i < n; i++)
+            if (strcmp(items[i], cond_operand(lhs)) == 0) return 1;
+        return 0;
+    }
+    const char *a = cond_operand(lhs), *b = cond_operand(rhs);
+    if (strcmp(op, "MATCHES") == 0) return cond_matches(a, rhs);
+
+    int cmp;
+    const char *rel = op;
+    if (strncmp(op, "VERSION_", 8) == 0) {
+        cmp = compare_versions(a, b);
+        rel = op + 8;
+    } else if (strncmp(op, "STR", 3) == 0) {
+        cmp = strcmp(a, b);
+        rel = op + 3;
+    } else {
+        double x, y;
+        if (!parse_number(a, &x) || !parse_number(b, &y)) return 0;
+        cmp = x < y ? -1 : x > y;
+    }
+    if (strcmp(rel, "EQUAL") == 0) return cmp == 0;
+    if (strcmp(rel, "LESS") == 0) return cmp < 0;
+    if (strcmp(rel, "GREATER") == 0) return cmp > 0;
+    if (strcmp(rel, "LESS_EQUAL") == 0) return cmp <= 0;
+    return cmp >= 0;            // GREATER_EQUAL
+}
+static int cond_unary(const char *op, const char *arg) {
+    struct stat st;
+    if (strcmp(op, "DEFINED") == 0) {
+        size_t len = strlen(arg);
+        if (strncmp(arg, "ENV{", 4) == 0 && len > 5 && arg[len - 1] == '}') {
+            StrBuf name = {0};
+            sb_putn(&name, arg + 4, len - 5);
+            return getenv(sb_str(&name)) != NULL;
+        }
+        return var_defined(arg);
+    }
+    if (strcmp(op, "EXISTS") == 0) return *arg && stat(arg, &st) == 0;
+    if (strcmp(op, "IS_DIRECTORY") == 0) return *arg && stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+    if (strcmp(op, "IS_ABSOLUTE") == 0)
+        return arg[0] == '/' || (isalpha((unsigned char)arg[0]) && arg[1] == ':');
+    if (strcmp(op, "COMMAND") == 0) return command_exists(arg);
+    return find_target(arg) != NULL;    // TARGET
+}
+static int is_unary_test(const char *s) {
+    return strcmp(s, "DEFINED") == 0 || strcmp(s, "EXISTS") == 0 || strcmp(s, "IS_DIRECTORY") == 0 ||
+           strcmp(s, "IS_ABSOLUTE") == 0 || strcmp(s, "COMMAND") == 0 || strcmp(s, "TARGET") == 0;
+}
+
+static int cond_or(CondParser *p);
+static int cond_at(const CondParser *p, const char *word) {
+    return p->pos < p->argc && strcmp(p->argv[p->pos], word) == 0;
+}
+static int cond_primary(CondParser *p) {
+    if (p->pos >= p->argc) return 0;
+    if (cond_at(p, "(")) {
+        p->pos++;
+        int val = cond_or(p);
+        if (cond_at(p, ")")) p->pos++;
+        else p->pos = p->argc + 1;      // unbalanced: reported by eval_condition()
+        return val;
+    }
+    const char *arg = p->argv[p->pos++];
+    if (is_unary_test(arg) && p->pos < p->argc) return cond_unary(arg, p->argv[p->pos++]);
+    if (p->pos + 1 < p->argc && is_binary_test(p->argv[p->pos])) {
+        const char *op = p->argv[p->pos];
+        p->pos += 2;
+        return cond_binary(arg, op, p->argv[p->pos - 1]);
+    }
+    return cond_truth(arg);
+}
+static int cond_not(CondParser *p) {
+    if (cond_at(p, "NOT")) {
+        p->pos++;
+        return !cond_not(p);
+    }
+    return cond_primary(p);
+}
+static int cond_and(CondParser *p) {
+    int val = cond_not(p);
+    while (cond_at(p, "AND")) {
+        p->pos++;
+        int rhs = cond_not(p);
+        val = val && rhs;
+    }
+    return val;
+}
+static int cond_or(CondParser *p) {
+    int val = cond_and(p);
+    while (cond_at(p, "OR")) {
+        p->pos++;
+        int rhs = cond_and(p);
+        val = val || rhs;
+    }
+    return val;
+}
+// 1 or 0, or -1 if the arguments do not form an expression
+static int eval_condition(int argc, char **argv) {
+    CondParser p = { argv, argc, 0 };
+    int val = cond_or(&p);
+    return p.pos == argc ? val : -1;
+}
+
+// ---- Command Handlers ----
+// Handlers receive the expanded arguments; argv lives in the scratch arena,
+// so anything kept past the command must be copied (add_string/setvar do).
+enum { SCOPE_PRIVATE = 1, SCOPE_INTERFACE = 2, SCOPE_PUBLIC = 3 };
+
+// Scope bits for a PUBLIC/PRIVATE/INTERFACE keyword, 0 for anything else
+static int scope_keyword(const char *s) {
+    if (strcmp(s, "PUBLIC") == 0) return SCOPE_PUBLIC;
+    if (strcmp(s, "PRIVATE") == 0) return SCOPE_PRIVATE;
+    if (strcmp(s, "INTERFACE") == 0) return SCOPE_INTERFACE;
+    return 0;
+}
+// Adds value to the target's own list and/or its interface list
+static void add_scoped(int scope, char ***own, int *nown, char ***iface, int *niface, const char *value) {
+    if (scope & SCOPE_PRIVATE) add_string(own, nown, value);
+    if (scope & SCOPE_INTERFACE) add_string(iface, niface, value);
+}
+// Appends flags to a space-joined list, dropping MSVC-style /flags on Unix
+static void append_flags(StrBuf *b, int argc, char **argv) {
+    for (int i = 0; i < argc; i++) {
+#ifndef _WIN32
+        // Skip MSVC-style flags on Unix
+        if (argv[i][0] == '/' && argv[i][1] != '\0')
+            continue;
+#endif
+        sb_puts(b, argv[i]);
+        sb_putc(b, ' ');
+    }
+}
+static int check_new_target(const char *name) {
+    if (!find_target(name)) return 1;
+    fprintf(message_out(), "CMake Error: target \"%s\" already exists.\n", name);
+    configure_error = 1;
+    return 0;
+}
+
+void cmd_cmake_minimum_required(int argc, char **argv) {
+    DPRINTF("cmake_minimum_required: %s\n", join_args(argc, argv, " "));
+}
+void cmd_message(int argc, char **argv) {
+    static const struct { const char *mode; int level; } modes[] = {
+        { "FATAL_ERROR", LOG_ERROR }, { "SEND_ERROR", LOG_ERROR }, { "WARNING", LOG_WARNING },
+        { "AUTHOR_WARNING", LOG_WARNING }, { "DEPRECATION", LOG_WARNING }, { "NOTICE", LOG_NOTICE },
+        { "STATUS", LOG_STATUS }, { "VERBOSE", LOG_VERBOSE }, { "DEBUG", LOG_DEBUG }, { "TRACE", LOG_TRACE },
+    };
+    int level = LOG_NOTICE;
+    for (size_t i = 0; argc && i < sizeof modes / sizeof modes[0]; i++) {
+        if (strcmp(argv[0], modes[i].mode) != 0) continue;
+        level = modes[i].level;
+        argc--;
+        argv++;
+        break;
+    }
+    if (level == LOG_ERROR) configure_error = 1;
+    if (level > log_level) return;
+    const char *text = join_args(argc, argv, "");
+    FILE *out = message_out();
+    if (level == LOG_ERROR) fprintf(out, "CMake Error: %s\n", text);
+    else if (level == LOG_WARNING) fprintf(out, "CMake Warning: %s\n", text);
+    else if (level == LOG_NOTICE) fprintf(out, "%s\n", text);
+    else fprintf(out, "-- %s\n", text);
+}
+void cmd_add_compile_options(int argc, char **argv) {
+    StrBuf b = {0};
+    sb_puts(&b, getvar("CMAKE_C_FLAGS"));
+    sb_putc(&b, ' ');
+    append_flags(&b, argc, argv);
+    setvar("CMAKE_C_FLAGS", sb_str(&b));
+}
+
+void cmd_set(int argc, char **argv) {
+    if (argc < 1) return;
+    const char *key = argv[0];
+    int nval = argc - 1, parent = 0;
+    // set(VAR value CACHE TYPE "doc" [FORCE]) and set(VAR value PARENT_SCOPE)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "CACHE") == 0 || strcmp(argv[i], "PARENT_SCOPE") == 0) {
+            nval = i - 1;
+            parent = argv[i][0] == 'P';
+            break;
+        }
+    }
+
+    // One value is a string, several a list; set(VAR) with none unsets VAR
+    static const Value undefined;
+    Value val = nval == 0 ? undefined : nval == 1 ? string_value(argv[1]) : list_value(nval, argv + 1);
+    // --- FILTER CMAKE_C_FLAGS ON NON-WINDOWS ---
+    if (strcmp(key, "CMAKE_C_FLAGS") == 0) {
+        StrBuf b = {0};
+        append_flags(&b, nval, argv + 1);
+        val = string_value(sb_str(&b));
+    }
+
+    if (parent) set_parent_scope(key, val);
+    else setvar_value(key, val);
+}
+void cmd_unset(int argc, char **argv) {
+    static const Value undefined;
+    if (argc < 1) return;
+    if (argc > 1 && strcmp(argv[1], "PARENT_SCOPE") == 0) set_parent_scope(argv[0], undefined);
+    else unsetvar(argv[0]);
+}
+
+// list(APPEND <list> <element>...), list(REMOVE_DUPLICATES <list>) and
+// list(FILTER <list> INCLUDE|EXCLUDE REGEX <regex>)
+void cmd_list(int argc, char **argv) {
+    if (argc < 2) return;
+    const char *op = argv[0], *name = argv[1];
+    Value *cur = find_value(name, strlen(name));
+    if (strcmp(op, "APPEND") == 0) {
+        if (argc == 2) return;
+        if (!cur || !cur->items) {
+            char **items = NULL;
+            int n = list_items(name, &items, 0);
+            for (int i = 2; i < argc; i++) {
+                items = arena_grow(&scratch_arena, items, n, sizeof(char *));
+                items[n++] = argv[i];
+            }
+            setvar_list(name, n, items);
+            return;
+        }
+        // Appending writes past the end of the current elements only, so
+        // older copies of the value stay intact. A list read from a parent
+        // scope is copied first: the array may be shared with other threads.
+        Var *own = scope_var(cur_scope, intern_find(name, strlen(name)));
+        Value v = own && &own->val == cur ? *cur : list_copy(cur->nitem, cur->items);
+        v.str = NULL;
+        for (int i = 2; i < argc; i++) {
+            v.items = arena_grow(&config_arena, (void *)v.items, v.nitem, sizeof(char *));
+            v.items[v.nitem++] = intern_n(argv[i], strlen(argv[i]));
+        }
+        setvar_value(name, v);
+        return;
+    }
+
+    char **items = NULL;
+    int n = list_items(name, &items, 0), kept = 0;
+    if (!cur) return;
+    if (strcmp(op, "REMOVE_DUPLICATES") == 0) {
+        NameIndex seen = {0};
+        for (int i = 0; i < n; i++) {
+            const char *k = intern_n(items[i], strlen(items[i]));
+            if (name_index_get(&seen, k) >= 0) continue;
+            name_index_put(&seen, k, i);
+            items[kept++] = (char *)k;
+        }
+        free(seen.keys);
+        free(seen.vals);
+    } else if (strcmp(op, "FILTER") == 0 && argc == 5 && strcmp(argv[3], "REGEX") == 0) {
+        int include = strcmp(argv[2], "INCLUDE") == 0;
+#ifndef _WIN32
+        regex_t re;
+        if (regcomp(&re, argv[4], REG_EXTENDED | REG_NOSUB) != 0) {
+            fprintf(message_out(), "CMake Error: list(FILTER) invalid regex: %s\n", argv[4]);
+            configure_error = 1;
+            return;
+        }
+        for (int i = 0; i < n; i++)
+            if ((regexec(&re, items[i], 0, NULL, 0) == 0) == include) items[kept++] = items[i];
+        regfree(&re);
+#else
+        for (int i = 0; i < n; i++)
+            if ((strstr(items[i], argv[4]) != NULL) == include) items[kept++] = items[i];
+#endif
+    } else {
+        DPRINTF("list(%s): not supported\n", op);
+        return;
+    }
+    setvar_list(name, kept, items);
+}
+void cmd_add_definitions(int argc, char **argv) {
+    // Every target changes, including the ones other threads can see
+    if (subdir_job) {
+        run_serially();
+        return;
+    }
+    watch_pin(1);
+    for (int j = 0; j < argc; j++) {
+        for (int i = 0; i < ntarget; i++) {
+            add_string(&targets[i].defs, &targets[i].ndef, argv[j]);
+        }
+        DPRINTF("add_definitions to all targets: %s\n", argv[j]);
+    }
+}
+void cmd_add_library(int argc, char **argv) {
+    if (argc < 1) return;
+    const char *type = "STATIC";
+    int first = 1;
+    if (argc > 1) {
+        if (strcasecmp(argv[1], "STATIC") == 0) first = 2;
+        else if (strcasecmp(argv[1], "SHARED") == 0 || strcasecmp(argv[1], "MODULE") == 0) {
+            type = "SHARED";
+            first = 2;
+        }
+    }
+
+    if (!check_new_target(argv[0])) return;
+    Target *t = new_target(argv[0], type);
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "EXCLUDE_FROM_ALL") == 0) continue;
+        add_string(&t->srcs, &t->nsrc, argv[i]);
+    }
+    init_target_props(t);
+
+    DPRINTF("add_library: %s type %s [%d srcs]\n",
+            t->name, t->type, t->nsrc);
+}
+void cmd_add_executable(int argc, char **argv) {
+    if (argc < 1 || !check_new_target(argv[0])) return;
+    Target *t = new_target(argv[0], "EXE");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "WIN32") == 0 || strcmp(argv[i], "MACOSX_BUNDLE") == 0 ||
+            strcmp(argv[i], "EXCLUDE_FROM_ALL") == 0)
+            continue;
+        add_string(&t->srcs, &t->nsrc, argv[i]);
+    }
+    init_target_props(t);
+
+    DPRINTF("add_executable: %s [%d srcs]\n", t->name, t->nsrc);
+}
+static int run_script_file(const char *path);
+void cmd_include(int argc, char **argv) {
+    if (argc < 1) return;
+    int optional = argc > 1 && strcmp(argv[1], "OPTIONAL") == 0;
+
+    DPRINTF("include: %s\n", argv[0]);
+
+    if (!run_script_file(argv[0]) && !optional)
+        DPRINTF("include failed: %s not found\n", argv[0]);
+}
+static void configure_directory(const char *dir);
+// add_subdirectory(<dir>): dir is relative to the current source directory.
+// A path from the top directory, which older projects here use, also works.
+void cmd_add_subdirectory(int argc, char **argv) {
+    if (argc < 1) return;
+    const char *dir = argv[0];
+    const char *top = getvar("CMAKE_SOURCE_DIR"), *cur = getvar("CMAKE_CURRENT_SOURCE_DIR");
+    size_t tlen = strlen(top);
+    if (dir[0] != '/' && !(dir[0] && dir[1] == ':') && strcmp(cur, top) != 0) {
+        // Named from the top directory when the current one is inside it
+        StrBuf b = {0};
+        sb_puts(&b, tlen && strncmp(cur, top, tlen) == 0 && cur[tlen] == '/' ? cur + tlen + 1 : cur);
+        sb_putc(&b, '/');
+        sb_puts(&b, dir);
+        sb_puts(&b, "/CMakeLists.txt");
+        if (file_mtime(sb_str(&b)) >= 0) {
+            b.len -= strlen("/CMakeLists.txt");
+            b.data[b.len] = 0;
+            dir = sb_str(&b);
+        }
+    }
+    configure_directory(dir);
+}
+void cmd_include_directories_global(int argc, char **argv) {
+    watch_pin(1);
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "SYSTEM") == 0 || strcmp(argv[i], "BEFORE") == 0 ||
+            strcmp(argv[i], "AFTER") == 0)
+            continue;
+        add_string(&global_incs, &nglobal_incs, argv[i]);
+    }
+
+    DPRINTF("include_directories (global): %s\n", join_args(argc, argv, " "));
+}
+void cmd_include_dirs(int argc, char **argv) {
+    if (argc < 2) return;
+    Target *t = modify_target(argv[0]);
+    if (!t) return;
+
+    int scope = SCOPE_PUBLIC;
+    for (int i = 1; i < argc; i++) {
+        if (scope_keyword(argv[i])) { scope = scope_keyword(argv[i]); continue; }
+        if (strcmp(argv[i], "SYSTEM") == 0 || strcmp(argv[i], "BEFORE") == 0 ||
+            strcmp(argv[i], "AFTER") == 0)
+            continue;
+        add_scoped(scope, &t->incs, &t->ninc, &t->iface_incs, &t->niface_inc, argv[i]);
+    }
+
+    DPRINTF("target_include_directories: %s\n", t->name);
+}
+void cmd_target_compile_definitions(int argc, char **argv) {
+    if (argc < 2) return;
+    Target *t = modify_target(argv[0]);
+    if (!t) return;
+
+    int scope = SCOPE_PUBLIC;
+    for (int i = 1; i < argc; i++) {
+        if (scope_keyword(argv[i])) { scope = scope_keyword(argv[i]); continue; }
+        const char *def = argv[i];
+        if (strncmp(def, "-D", 2) != 0) {
+            StrBuf b = {0};
+            sb_puts(&b, "-D");
+            sb_puts(&b, def);
+            def = sb_str(&b);
+        }
+        add_scoped(scope, &t->defs, &t->ndef, &t->iface_defs, &t->niface_def, def);
+    }
+
+    DPRINTF("target_compile_definitions: %s\n", t->name);
+}
+// set_target_properties(<targets>... PROPERTIES <key> <value>...)
+void cmd_set_target_properties(int argc, char **argv) {
+    int p = 0;
+    while (p < argc && strcmp(argv[p], "PROPERTIES") != 0) p++;
+    for (int i = 0; i < p; i++) {
+        Target *t = modify_target(argv[i]);
+        if (!t) {
+            DPRINTF("set_target_properties: no target '%s'\n", argv[i]);
+            continue;
+        }
+        for (int k = p + 1; k + 1 < argc; k += 2) set_target_prop(t, argv[k], argv[k + 1]);
+    }
+}
+// set_source_files_properties(<files>... [DIRECTORY <dirs>...] PROPERTIES <key> <value>...)
+void cmd_set_source_files_properties(int argc, char **argv) {
+    int p = 0;
+    while (p < argc && strcmp(argv[p], "PROPERTIES") != 0) p++;
+    for (int i = 0; i < p; i++) {
+        // Directory scopes do not exist here, every source is global
+        if (strcmp(argv[i], "DIRECTORY") == 0 || strcmp(argv[i], "TARGET_DIRECTORY") == 0) break;
+        for (int k = p + 1; k + 1 < argc; k += 2) set_source_prop(argv[i], argv[k], argv[k + 1]);
+    }
+}
+// target_precompile_headers(<t> PRIVATE|PUBLIC|INTERFACE <header>...)
+// target_precompile_headers(<t> REUSE_FROM <other>)
+void cmd_target_precompile_headers(int argc, char **argv) {
+    if (argc < 2) return;
+    Target *t = modify_target(argv[0]);
+    if (!t) return;
+
+    if (strcmp(argv[1], "REUSE_FROM") == 0) {
+        if (argc > 2) t->pch_reuse = intern_n(argv[2], strlen(argv[2]));
+        return;
+    }
+    int scope = SCOPE_PRIVATE;
+    for (int i = 1; i < argc; i++) {
+        if (scope_keyword(argv[i])) { scope = scope_keyword(argv[i]); continue; }
+        add_scoped(scope, &t->pchs, &t->npch, &t->iface_pchs, &t->niface_pch, argv[i]);
+    }
+
+    DPRINTF("target_precompile_headers: %s\n", t->name);
+}
+// Only records the direct dependencies; resolve_targets() propagates usage
+// requirements through the whole graph once configure is done
+void cmd_target_link_libs(int argc, char **argv) {
+    if (argc < 2) {
+        DPRINTF("target_link_libraries: parse failed\n");
+        return;
+    }
+
+    Target *dst = modify_target(argv[0]);
+    if (!dst) return;
+
+    // Without a keyword the plain signature makes dependencies transitive
+    int scope = SCOPE_PUBLIC;
+    for (int a = 1; a < argc; a++) {
+        if (scope_keyword(argv[a])) { scope = scope_keyword(argv[a]); continue; }
+        if (strcmp(argv[a], "LINK_PUBLIC") == 0) { scope = SCOPE_PUBLIC; continue; }
+        if (strcmp(argv[a], "LINK_PRIVATE") == 0) { scope = SCOPE_PRIVATE; continue; }
+        TPRINTF("Processing lib token='%s'\n", argv[a]);
+        add_scoped(scope, &dst->libs, &dst->nlib, &dst->iface_libs, &dst->niface_lib, argv[a]);
+    }
+
+    DPRINTF("target_link_libraries: %s\n", dst->name);
+}
+void cmd_project(int argc, char **argv) {
+    if (argc < 1) return;
+    setvar("PROJECT_NAME", argv[0]);
+    DPRINTF("project: set PROJECT_NAME = %s\n", argv[0]);
+}
+
+static int is_true(const char *s) {
+    return strcasecmp(s, "ON") == 0 || strcasecmp(s, "TRUE") == 0 ||
+           strcasecmp(s, "YES") == 0 || strcmp(s, "1") == 0;
+}
+// file(GLOB|GLOB_RECURSE <var> [LIST_DIRECTORIES b] [RELATIVE path]
+//      [FOLLOW_SYMLINKS] [CONFIGURE_DEPENDS] <patterns>...)
+void cmd_file(int argc, char **argv) {
+    if (argc < 2 || (strcmp(argv[0], "GLOB") != 0 && strcmp(argv[0], "GLOB_RECURSE") != 0)) {
+        DPRINTF("file(%s): not supported\n", argc ? argv[0] : "");
+        return;
+    }
+    const char *var = argv[1];
+    GlobSpec g = {0};
+    g.recurse = strcmp(argv[0], "GLOB_RECURSE") == 0;
+    g.list_dirs = !g.recurse;
+    const char *relative = NULL;
+
+    char **files = NULL;
+    int nfile = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "CONFIGURE_DEPENDS") == 0) { g.configure_depends = 1; continue; }
+        if (strcmp(argv[i], "FOLLOW_SYMLINKS") == 0) { g.follow = 1; continue; }
+        if (strcmp(argv[i], "LIST_DIRECTORIES") == 0 && i + 1 < argc) { g.list_dirs = is_true(argv[++i]); continue; }
+        if (strcmp(argv[i], "RELATIVE") == 0 && i + 1 < argc) { relative = argv[++i]; continue; }
+        glob_pattern(&g, argv[i], &files, &nfile);
+    }
+
+    size_t rlen = relative ? strlen(relative) : 0;
+    for (int i = 0; rlen && i < nfile; i++)
+        if (strncmp(files[i], relative, rlen) == 0 && files[i][rlen] == '/') files[i] += rlen + 1;
+    setvar_list(var, nfile, files);
+    DPRINTF("file(%s): %s = %d files\n", argv[0], var, nfile);
+}
+// ---- Usage Requirements ----
+// Insertion-ordered set of interned strings, used to build de-duplicated lists
+typedef struct {
+    char **items;
+    int n;
+    NameIndex seen;
+} OrderedSet;
+
+static int oset_add(OrderedSet *s, const char *value) {
+    const char *k = intern_n(value, strlen(value));
+    if (name_index_get(&s->seen, k) >= 0) return 0;
+    name_index_put(&s->seen, k, s->n);
+    s->items = arena_grow(&config_arena, s->items, s->n, sizeof(char *));
+    s->items[s->n++] = (char *)k;
+    return 1;
+}
+static void oset_add_all(OrderedSet *s, char **items, int n) {
+    for (int i = 0; i < n; i++) oset_add(s, items[i]);
+}
+static void oset_free(OrderedSet *s) {
+    free(s->seen.keys);
+    free(s->seen.vals);
+}
+
+// Computes the transitive interface of t after that of every target it links to
+static void resolve_target(Target *t) {
+    if (t->resolve_state == 2) return;
+    if (t->resolve_state == 1) {
+        DPRINTF("dependency cycle through target '%s'\n", t->name);
+        return;
+    }
+    t->resolve_state = 1;
+    for (int i = 0; i < t->nlib; i++) {
+        Target *d = find_target(t->libs[i]);
+        if (d) resolve_target(d);
+    }
+    for (int i = 0; i < t->niface_lib; i++) {
+        Target *d = find_target(t->iface_libs[i]);
+        if (d) resolve_target(d);
+    }
+
+    OrderedSet ii = {0}, id = {0}, ip = {0};
+    oset_add_all(&ii, t->iface_incs, t->niface_inc);
+    oset_add_all(&id, t->iface_defs, t->niface_def);
+    oset_add_all(&ip, t->iface_pchs, t->niface_pch);
+    for (int i = 0; i < t->niface_lib; i++) {
+        Target *d = find_target(t->iface_libs[i]);
+        if (!d) continue;
+        oset_add_all(&ii, d->all_iface_incs, d->nall_iface_inc);
+        oset_add_all(&id, d->all_iface_defs, d->nall_iface_def);
+        oset_add_all(&ip, d->all_iface_pchs, d->nall_iface_pch);
+    }
+    t->all_iface_incs = ii.items; t->nall_iface_inc = ii.n;
+    t->all_iface_defs = id.items; t->nall_iface_def = id.n;
+    t->all_iface_pchs = ip.items; t->nall_iface_pch = ip.n;
+
+    OrderedSet ui = {0}, ud = {0}, up = {0};
+    oset_add_all(&ui, t->incs, t->ninc);
+    oset_add_all(&ud, t->defs, t->ndef);
+    oset_add_all(&up, t->pchs, t->npch);
+    for (int i = 0; i < t->nlib; i++) {
+        Target *d = find_target(t->libs[i]);
+        if (!d) continue;
+        oset_add_all(&ui, d->all_iface_incs, d->nall_iface_inc);
+        oset_add_all(&ud, d->all_iface_defs, d->nall_iface_def);
+        oset_add_all(&up, d->all_iface_pchs, d->nall_iface_pch);
+    }
+    t->use_incs = ui.items; t->nuse_inc = ui.n;
+    t->use_defs = ud.items; t->nuse_def = ud.n;
+    t->use_pchs = up.items; t->nuse_pch = up.n;
+
+    oset_free(&ii); oset_free(&id); oset_free(&ip);
+    oset_free(&ui); oset_free(&ud); oset_free(&up);
+    t->resolve_state = 2;
+}
+
+// Depth-first walk of what linking `item` pulls in. A static library also
+// needs its private dependencies at the final link; a shared one does not.
+static void link_visit(OrderedSet *post, NameIndex *entered, const char *item) {
+    const char *k = intern_n(item, strlen(item));
+    if (name_index_get(entered, k) >= 0) return;
+    name_index_put(entered, k, 1);
+
+    Target *d = find_target(k);
+    if (d) {
+        // Visit children last-to-first so the reversed order keeps declaration order
+        for (int i = d->niface_lib - 1; i >= 0; i--) link_visit(post, entered, d->iface_libs[i]);
+        if (strcmp(d->type, "STATIC") == 0)
+            for (int i = d->nlib - 1; i >= 0; i--) link_visit(post, entered, d->libs[i]);
+    }
+    oset_add(post, k);
+}
+static void resolve_link_items(Target *t) {
+    OrderedSet post = {0};
+    NameIndex entered = {0};
+    name_index_put(&entered, t->name, 1);
+    for (int i = t->nlib - 1; i >= 0; i--) link_visit(&post, &entered, t->libs[i]);
+
+    // Reverse post-order: every library comes before the ones it depends on
+    t->nlink_item = 0;
+    t->link_items = NULL;
+    for (int i = post.n - 1; i >= 0; i--) {
+        t->link_items = arena_grow(&config_arena, t->link_items, t->nlink_item, sizeof(char *));
+        t->link_items[t->nlink_item++] = post.items[i];
+    }
+    oset_free(&post);
+    free(entered.keys);
+    free(entered.vals);
+}
+
+// Propagates PUBLIC/PRIVATE/INTERFACE requirements over the dependency graph.
+// Runs once after configure (or after loading the cache).
+static void resolve_targets(void) {
+    for (int i = 0; i < ntarget; i++) targets[i].resolve_state = 0;
+    for (int i = 0; i < ntarget; i++) resolve_target(&targets[i]);
+    for (int i = 0; i < ntarget; i++) resolve_link_items(&targets[i]);
+}
+
+// ---- Build Rule Helpers ----
+#define OBJ_ROOT "CMakeFiles"
+
+// Name of the file a target produces: app, libfoo.a or libfoo.so
+static const char *target_output(const Target *t) {
+    static char out[256];
+    if (strcmp(t->type, "STATIC") == 0) snprintf(out, sizeof(out), "lib%s.a", t->name);
+    else if (strcmp(t->type, "SHARED") == 0) snprintf(out, sizeof(out), "lib%s%s", t->name, SHARED_NAME);
+    else snprintf(out, sizeof(out), "%s", t->name);
+    return out;
+}
+// Object file for a source: CMakeFiles/<target>.dir/<source relative to the top dir>.o
+static void object_path(const Target *t, const char *src, char *buf, size_t buflen) {
+    const char *top = getvar("CMAKE_SOURCE_DIR");
+    size_t toplen = strlen(top);
+    if (toplen && strncmp(src, top, toplen) == 0 && src[toplen] == '/') src += toplen + 1;
+    while (*src == '/') src++;
+
+    int n = snprintf(buf, buflen, "%s/%s.dir/", OBJ_ROOT, t->name);
+    if (n < 0 || (size_t)n >= buflen) return;
+    // Generated sources such as unity files already live in the target dir
+    if (strncmp(src, buf, n) == 0) src += n;
+    char *dst = buf + n;
+    char *end = buf + buflen - 4;
+    for (const char *p = src; *p && dst < end; p++) {
+        // Keep objects inside the target dir even for ../ and C:\ style sources
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\\') &&
+            (p == src || p[-1] == '/' || p[-1] == '\\')) {
+            *dst++ = '_'; *dst++ = '_'; p++;
+        } else if (*p == ':') {
+            *dst++ = '_';
+        } else {
+            *dst++ = *p;
+        }
+    }
+    strcpy(dst, ".o");
+}
+// Project target behind a link item, if the build produces it
+static const Target *link_dep(const char *item) {
+    const Target *dep = find_target(item);
+    return dep && *dep->name ? dep : NULL;
+}
+// Outputs of the project libraries a target links, for rule dependencies
+static const char *target_link_deps(const Target *t) {
+    StrBuf b = {0};
+    for (int j = 0; j < t->nlink_item; j++) {
+        const Target *dep = link_dep(t->link_items[j]);
+        if (!dep) continue;
+        sb_putc(&b, ' ');
+        sb_puts(&b, target_output(dep));
+    }
+    return sb_str(&b);
+}
+// Linker arguments for everything a target links against, in link order.
+// Static targets are named by path so -l never picks up a system library of
+// the same name; other targets and bare names become -l flags.
+static const char *target_link_flags(const Target *t) {
+    StrBuf b = {0};
+    for (int j = 0; j < t->nlink_item; j++) {
+        const char *item = t->link_items[j];
+        const Target *dep = link_dep(item);
+        sb_putc(&b, ' ');
+        if (dep && strcmp(dep->type, "STATIC") == 0) {
+            sb_puts(&b, target_output(dep));
+        } else if (!dep && (item[0] == '-' || strchr(item, '/') ||
+                            has_suffix(item, ".a") || has_suffix(item, SHARED_NAME))) {
+            sb_puts(&b, item);
+        } else {
+            sb_puts(&b, "-l");
+            sb_puts(&b, item);
+        }
+    }
+    return sb_str(&b);
+}
+static int target_ipo(const Target *t) {
+    const char *ipo = target_prop(t, "INTERPROCEDURAL_OPTIMIZATION");
+    return ipo && is_true(ipo);
+}
+// Where an instrumented target writes its profiles. Absolute, since the
+// training run may start in any directory.
+static const char *pgo_dir(const Target *t) {
+    StrBuf b = {0};
+    sb_puts(&b, getvar("CMAKE_SOURCE_DIR"));
+    sb_puts(&b, "/" OBJ_ROOT "/");
+    sb_puts(&b, t->name);
+    sb_puts(&b, ".dir/pgo");
+    return sb_str(&b);
+}
+// CMAKE_C_FLAGS of the target's directory, CMAKE_C_FLAGS_<BUILD_TYPE>, -flto
+// and the PGO phase: passed to both the compiler and the linker, as the link
+// step compiles LTO objects and pulls in the profiling runtime
+static const char *target_c_flags(const Target *t) {
+    StrBuf b = {0};
+    sb_puts(&b, t->dir_flags ? t->dir_flags : getvar("CMAKE_C_FLAGS"));
+    const char *type = getvar("CMAKE_BUILD_TYPE");
+    if (*type) {
+        char var[64];
+        int n = snprintf(var, sizeof var, "CMAKE_C_FLAGS_");
+        for (const char *p = type; *p && n < (int)sizeof var - 1; p++) var[n++] = toupper((unsigned char)*p);
+        var[n] = 0;
+        sb_putc(&b, ' ');
+        sb_puts(&b, getvar_command(var));
+    }
+    // -flto=auto partitions the link-time compile and runs the partitions
+    // in parallel, through make's jobserver when there is one
+    if (target_ipo(t)) sb_puts(&b, " -flto=auto");
+    const char *pgo = getvar("CMAKE_PGO_PHASE");
+    if (strcasecmp(pgo, "GENERATE") == 0) {
+        sb_puts(&b, " -fprofile-generate=");
+        sb_puts(&b, pgo_dir(t));
+        sb_puts(&b, " -fprofile-update=prefer-atomic");
+    } else if (strcasecmp(pgo, "USE") == 0) {
+        // Code the training run never reached keeps its normal optimization,
+        // and an outdated profile is a warning rather than a failed build
+        sb_puts(&b, " -fprofile-use=");
+        sb_puts(&b, pgo_dir(t));
+        sb_puts(&b, " -fprofile-partial-training -Wno-error=coverage-mismatch");
+    }
+    return sb_str(&b);
+}
+// Archiver for a target: LTO objects need the compiler's plugin-aware ar
+// (gcc-ar, llvm-ar), or the archive gets no symbol index for them
+static const char *target_archiver(const Target *t) {
+    if (!target_ipo(t)) return "ar";
+    const char *ar = getvar("CMAKE_C_COMPILER_AR");
+    if (*ar) return ar;
+    const char *cc = getvar("CMAKE_C_COMPILER");
+    const char *base = strrchr(cc, '/');
+    base = base ? base + 1 : cc;
+    // x86_64-linux-gnu-gcc-12 -> x86_64-linux-gnu-gcc-ar-12
+    const char *gcc = strstr(base, "gcc");
+    if (gcc) {
+        StrBuf b = {0};
+        sb_putn(&b, cc, gcc + 3 - cc);
+        sb_puts(&b, "-ar");
+        sb_puts(&b, gcc + 3);
+        return sb_str(&b);
+    }
+    if (strstr(base, "clang")) return "llvm-ar";
+    return "ar";
+}
+// With CMAKE_THIN_ARCHIVES the archive only references the objects in the
+// target dir instead of copying them
+static const char *archive_command(const Target *t) {
+    StrBuf b = {0};
+    sb_puts(&b, target_archiver(t));
+    sb_puts(&b, is_true(getvar("CMAKE_THIN_ARCHIVES")) ? " rcsT" : " rcs");
+    return sb_str(&b);
+}
+// Appends a definition as one shell word. MSG="a b" must reach the compiler
+// with its quotes, as the string literal CMake makes of it, so anything the
+// shell would split or expand goes in single quotes; gcc reads response
+// files with the same quoting.
+static void sb_put_define(StrBuf *b, const char *def) {
+    if (!def[strcspn(def, " \t\n\"'\\$`;&|<>()*?[]#~!{}")]) {
+        sb_puts(b, def);
+        return;
+    }
+    sb_putc(b, '\'');
+    for (const char *p = def; *p; p++) {
+        if (*p == '\'') sb_puts(b, "'\\''");
+        else sb_putc(b, *p);
+    }
+    sb_putc(b, '\'');
+}
+// Flags every object of a target is compiled with
+static const char *target_compile_flags(const Target *t) {
+    StrBuf b = {0};
+    sb_putc(&b, ' ');
+    sb_puts(&b, target_c_flags(t));
+    if (strcmp(t->type, "SHARED") == 0) sb_puts(&b, " -fPIC");
+    if (strcmp(getvar("CMAKE_C_STANDARD"), "11") == 0) sb_puts(&b, " -std=c11");
+    for (int j = 0; j < t->nuse_def; j++) { sb_putc(&b, ' '); sb_put_define(&b, t->use_defs[j]); }
+    for (int j = 0; j < t->nuse_inc; j++) { sb_puts(&b, " -I"); sb_puts(&b, t->use_incs[j]); }
+    for (int j = 0; j < nglobal_incs; j++) { sb_puts(&b, " -I"); sb_puts(&b, global_incs[j]); }
+    return sb_str(&b);
+}
+// Object files of a target, space-separated with a leading space
+static const char *target_objects(const Target *t) {
+    StrBuf b = {0};
+    char obj[1024];
+    for (int j = 0; j < t->ncompile_src; j++) {
+        object_path(t, t->compile_srcs[j], obj, sizeof obj);
+        sb_putc(&b, ' ');
+        sb_puts(&b, obj);
+    }
+    return sb_str(&b);
+}
+
+// Command lines past this many bytes pass their arguments in a response file
+static size_t rsp_threshold(void) {
+    long n = atol(getvar("CMAKE_RESPONSE_FILE_THRESHOLD"));
+    return n > 0 ? (size_t)n : 32768;
+}
+static void write_text_if_changed(const char *path, const char *text) {
+    size_t len = strlen(text);
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        char *old = arena_alloc(&scratch_arena, len + 1);
+        size_t n = fread(old, 1, len + 1, f);
+        fclose(f);
+        if (n == len && memcmp(old, text, len) == 0) return;
+    }
+    make_parent_dirs(path);
+    f = fopen(path, "wb");
+    if (!f) return;
+    fwrite(text, 1, len, f);
+    fclose(f);
+}
+// Returns args unchanged when short enough, else writes them to
+// CMakeFiles/<target>.dir/<name>.rsp and returns " @<that file>"
+static const char *spill_to_rsp(const Target *t, const char *name, const char *args) {
+    if (strlen(args) <= rsp_threshold()) return args;
+    StrBuf path = {0};
+    sb_puts(&path, OBJ_ROOT "/");
+    sb_puts(&path, t->name);
+    sb_puts(&path, ".dir/");
+    sb_puts(&path, name);
+    sb_puts(&path, ".rsp");
+    write_text_if_changed(sb_str(&path), args);
+
+    StrBuf ref = {0};
+    sb_puts(&ref, " @");
+    sb_puts(&ref, sb_str(&path));
+    return sb_str(&ref);
+}
+// CMakeFiles/<target>.dir/flags.txt is rewritten only when the target's
+// compile flags change. Objects depend on it, so switching the build type or
+// PGO phase recompiles them. Ninja tracks command lines itself.
+static const char *flags_stamp(const Target *t) {
+    StrBuf path = {0};
+    sb_puts(&path, OBJ_ROOT "/");
+    sb_puts(&path, t->name);
+    sb_puts(&path, ".dir/flags.txt");
+    StrBuf text = {0};
+    sb_puts(&text, target_compile_flags(t));
+    sb_putc(&text, '\n');
+    write_text_if_changed(sb_str(&path), sb_str(&text));
+    return sb_str(&path);
+}
+// What compile commands start with: the built-in object cache if one is
+// configured, then CMAKE_C_COMPILER_LAUNCHER (a ;-list), then the compiler
+static const char *compiler_launch(void) {
+    StrBuf b = {0};
+#ifndef _WIN32
+    const char *cache = getvar("CMAKE_C_OBJECT_CACHE");
+    if (!*cache && getenv("MINI_CMAKE_OBJECT_CACHE")) cache = getenv("MINI_CMAKE_OBJECT_CACHE");
+    if (*cache) {
+        const char *size = getvar("CMAKE_C_OBJECT_CACHE_SIZE");
+        sb_puts(&b, getvar("CMAKE_COMMAND"));
+        sb_puts(&b, " --cache-compile ");
+        sb_puts(&b, cache);
+        sb_putc(&b, ' ');
+        sb_puts(&b, *size ? size : "5G");
+        sb_puts(&b, " -- ");
+    }
+#endif
+    for (const char *p = getvar("CMAKE_C_COMPILER_LAUNCHER"); *p; ) {
+        const char *semi = strchr(p, ';');
+        size_t len = semi ? (size_t)(semi - p) : strlen(p);
+        if (len) {
+            sb_putn(&b, p, len);
+            sb_putc(&b, ' ');
+        }
+        p += len + (semi != NULL);
+    }
+    sb_puts(&b, getvar("CMAKE_C_COMPILER"));
+    return sb_str(&b);
+}
+
+// With CMAKE_BUILD_TRACE, build steps run under `mini_cmake --trace-step`,
+// which appends their timing to the build trace log
+#define TRACE_LOG OBJ_ROOT "/build_trace.log"
+static int build_trace_enabled(void) {
+#ifndef _WIN32
+    return is_true(getvar("CMAKE_BUILD_TRACE"));
+#else
+    return 0;
+#endif
+}
+static const char *trace_prefix(const char *kind, const char *target, const char *out) {
+    if (!build_trace_enabled()) return "";
+    StrBuf b = {0};
+    sb_puts(&b, getvar("CMAKE_COMMAND"));
+    sb_puts(&b, " --trace-step ");
+    sb_puts(&b, kind);
+    sb_putc(&b, ' ');
+    sb_puts(&b, target);
+    sb_putc(&b, ' ');
+    sb_puts(&b, out);
+    sb_puts(&b, " -- ");
+    return sb_str(&b);
+}
+
+// ---- Precompiled Headers ----
+// Target whose precompiled header t's objects use, or NULL. REUSE_FROM shares
+// another target's header; it should be built with compatible flags.
+static const Target *pch_owner(const Target *t) {
+    for (int hops = 0; t && t->pch_reuse && hops < 8; hops++) t = find_target(t->pch_reuse);
+    return t && !t->pch_reuse && t->nuse_pch && t->nsrc ? t : NULL;
+}
+// CMakeFiles/<t>.dir/cmake_pch.h, the header the PCH is compiled from
+static const char *pch_header(const Target *owner) {
+    StrBuf b = {0};
+    sb_puts(&b, OBJ_ROOT "/");
+    sb_puts(&b, owner->name);
+    sb_puts(&b, ".dir/cmake_pch.h");
+    return sb_str(&b);
+}
+static const char *pch_output(const Target *owner) {
+    StrBuf b = {0};
+    sb_puts(&b, pch_header(owner));
+    sb_puts(&b, ".gch");
+    return sb_str(&b);
+}
+// Writes cmake_pch.h, which includes every header given to the target.
+// Relative paths are made absolute since the file lives under CMakeFiles.
+static void write_pch_header(const Target *owner) {
+    const char *top = getvar("CMAKE_SOURCE_DIR");
+    StrBuf b = {0};
+    sb_puts(&b, "/* generated by Mini_CMake */\n");
+    for (int i = 0; i < owner->nuse_pch; i++) {
+        const char *h = owner->use_pchs[i];
+        sb_puts(&b, "#include ");
+        if (h[0] == '<') {
+            sb_puts(&b, h);
+        } else {
+            sb_putc(&b, '"');
+            if (h[0] != '/' && !(h[0] && h[1] == ':') && *top) {
+                sb_puts(&b, top);
+                sb_putc(&b, '/');
+            }
+            sb_puts(&b, h);
+            sb_putc(&b, '"');
+        }
+        sb_putc(&b, '\n');
+    }
+    write_text_if_changed(pch_header(owner), sb_str(&b));
+}
+// Extra flags for t's objects: force-include the header, whose .gch gcc
+// picks up from the same directory; -Winvalid-pch reports when it cannot
+static const char *pch_use_flags(const Target *t) {
+    const Target *owner = pch_owner(t);
+    if (!owner) return "";
+    StrBuf b = {0};
+    sb_puts(&b, " -Winvalid-pch -include ");
+    sb_puts(&b, pch_header(owner));
+    return sb_str(&b);
+}
+
+// ---- Unity Builds ----
+// With UNITY_BUILD on, a target's C sources are compiled in batches of
+// UNITY_BUILD_BATCH_SIZE (default 8, 0 for one batch) through generated
+// unity_<N>_c.c files that #include them. Sources marked
+// SKIP_UNITY_BUILD_INCLUSION, and anything that is not C, compile alone.
+static void plan_target_sources(Target *t) {
+    t->compile_srcs = t->srcs;
+    t->ncompile_src = t->nsrc;
+    const char *unity = target_prop(t, "UNITY_BUILD");
+    if (!unity || !is_true(unity)) return;
+    const char *size = target_prop(t, "UNITY_BUILD_BATCH_SIZE");
+    int batch = size && *size ? atoi(size) : 8;
+
+    t->compile_srcs = NULL;
+    t->ncompile_src = 0;
+    const char *top = getvar("CMAKE_SOURCE_DIR");
+    StrBuf text = {0};
+    int nbatch = 0, nunity = 0;
+    for (int i = 0; i <= t->nsrc; i++) {
+        const char *src = i < t->nsrc ? t->srcs[i] : NULL;
+        if (src) {
+            const char *skip = source_prop(src, "SKIP_UNITY_BUILD_INCLUSION");
+            if (!has_suffix(src, ".c") || (skip && is_true(skip))) {
+                add_string(&t->compile_srcs, &t->ncompile_src, src);
+                continue;
+            }
+            if (!nbatch) sb_puts(&text, "/* generated by Mini_CMake */\n");
+            sb_puts(&text, "#include \"");
+            if (src[0] != '/' && !(src[0] && src[1] == ':') && *top) {
+                sb_puts(&text, top);
+                sb_putc(&text, '/');
+            }
+            sb_puts(&text, src);
+            sb_puts(&text, "\"\n");
+            nbatch++;
+        }
+        if (nbatch && (!src || nbatch == batch)) {
+            char path[1024];
+            snprintf(path, sizeof path, "%s/%s.dir/Unity/unity_%d_c.c", OBJ_ROOT, t->name, nunity++);
+            write_text_if_changed(path, sb_str(&text));
+            add_string(&t->compile_srcs, &t->ncompile_src, path);
+            text.len = 0;
+            nbatch = 0;
+        }
+    }
+}
+static void plan_sources(void) {
+    for (int i = 0; i < ntarget; i++) {
+        ArenaMark mark = arena_mark(&scratch_arena);
+        plan_target_sources(&targets[i]);
+        arena_release(&scratch_arena, mark);
+    }
+}
+
+// ---- Makefile Generator ----
+// --watch keeps each target's text, so only the targets a change replaced
+// or links to are generated again
+static void write_target_rules(FILE *out, Target *t, void (*write)(FILE *, Target *)) {
+#ifndef _WIN32
+    if (watching && !t->rules) {
+        char *text = NULL;
+        size_t len = 0;
+        FILE *mem = open_memstream(&text, &len);
+        if (mem) {
+            write(mem, t);
+            fclose(mem);
+            t->rules = arena_strndup(&config_arena, text, len);
+            free(text);
+        }
+    }
+    if (t->rules) {
+        fputs(t->rules, out);
+        return;
+    }
+#endif
+    write(out, t);
+}
+// Written by --verify-globs when a CONFIGURE_DEPENDS glob changed; the build
+// file depends on it, so make and ninja regenerate before building anything
+#define GLOB_STAMP OBJ_ROOT "/VerifyGlobs.stamp"
+static int has_configure_depends(void) {
+    for (int i = 0; i < nglob_record; i++)
+        if (glob_records[i].flags & GLOB_CONFIGURE_DEPENDS) return 1;
+    return 0;
+}
+
+// Text for a make variable: '$' and '#' would be expanded or start a comment
+static const char *make_escape(const char *s) {
+    if (!strpbrk(s, "$#")) return s;
+    StrBuf b = {0};
+    for (; *s; s++) {
+        if (*s == '$') sb_putc(&b, '$');
+        else if (*s == '#') sb_putc(&b, '\\');
+        sb_putc(&b, *s);
+    }
+    return sb_str(&b);
+}
+// Everything make needs for one target
+static void write_makefile_target(FILE *mk, Target *t) {
+    ArenaMark mark = arena_mark(&scratch_arena);
+    char obj[1024];
+
+    // Per-target flags and object list, so every object rule stays short
+    const char *objs = target_objects(t);
+    fprintf(mk, "%s_FLAGS =%s\n", t->name, make_escape(spill_to_rsp(t, "flags", target_compile_flags(t))));
+    fprintf(mk, "%s_OBJS =%s\n\n", t->name, objs);
+
+    // Long link and archive lines go through a response file
+    StrBuf link = {0};
+    sb_puts(&link, " $(");
+    sb_puts(&link, t->name);
+    sb_puts(&link, "_OBJS)");
+    const char *libs = target_link_flags(t);
+    if (strlen(objs) + strlen(libs) > rsp_threshold()) {
+        StrBuf all = {0};
+        sb_puts(&all, objs);
+        sb_puts(&all, libs);
+        link.len = 0;
+        sb_puts(&link, spill_to_rsp(t, "link", sb_str(&all)));
+    } else {
+        sb_puts(&link, libs);
+    }
+
+    // '+' hands make's jobserver to the LTO link
+    const char *jobserver = target_ipo(t) ? "+" : "";
+    if (strcmp(t->type, "EXE") == 0) {
+        fprintf(mk, "%s: $(%s_OBJS)%s", t->name, t->name, target_link_deps(t));
+        fprintf(mk, "\n\t%s%s%s %s -L. %s%s", jobserver, trace_prefix("LINK", t->name, "$@"),
+                getvar("CMAKE_C_COMPILER"),
+                target_c_flags(t),
+                EXE_RULES, sb_str(&link));
+        fprintf(mk, " -o $@\n\n");
+    } else if (strcmp(t->type, "STATIC") == 0) {
+        const char *args = spill_to_rsp(t, "archive", objs);
+        fprintf(mk, "lib%s.a: $(%s_OBJS)\n", t->name, t->name);
+        if (args != objs)
+            fprintf(mk, "\trm -f $@\n\t%s%s $@%s\n\n", trace_prefix("AR", t->name, "$@"),
+                    archive_command(t), args);
+        else
+            fprintf(mk, "\trm -f $@\n\t%s%s $@ $(%s_OBJS)\n\n", trace_prefix("AR", t->name, "$@"),
+                    archive_command(t), t->name);
+    } else if (strcmp(t->type, "SHARED") == 0) {
+        fprintf(mk, "lib%s%s: $(%s_OBJS)%s\n", t->name, SHARED_NAME, t->name, target_link_deps(t));
+        fprintf(mk, "\t%s%s%s -shared -fPIC %s -L. %s%s", jobserver, trace_prefix("LINK", t->name, "$@"),
+                getvar("CMAKE_C_COMPILER"),
+                target_c_flags(t),
+                LINK_RULES, sb_str(&link));
+        fprintf(mk, " -o $@\n\n");
+    }
+
+    // The precompiled header is built with the target's own flags
+    const char *stamp = flags_stamp(t);
+    const Target *owner = pch_owner(t);
+    if (owner == t) {
+        write_pch_header(t);
+        fprintf(mk, "%s_PCH = %s\n", t->name, pch_output(t));
+        fprintf(mk, "$(%s_PCH): %s %s\n", t->name, pch_header(t), stamp);
+        fprintf(mk, "\t%s%s $(%s_FLAGS) -x c-header -MMD -MP -MF $@.d -c $< -o $@\n\n",
+                trace_prefix("PCH", t->name, "$@"), compiler_launch(), t->name);
+    }
+
+    // One rule per source, so `make -jN` can compile them in parallel
+    const char *pch_flags = pch_use_flags(t);
+    const char *trace = trace_prefix("CC", t->name, "$@");
+    for (int j = 0; j < t->ncompile_src; j++) {
+        object_path(t, t->compile_srcs[j], obj, sizeof obj);
+        fprintf(mk, "%s: %s %s", obj, t->compile_srcs[j], stamp);
+        if (owner) fprintf(mk, " %s", pch_output(owner));
+        fprintf(mk, "\n\t@mkdir -p $(dir $@)\n");
+        fprintf(mk, "\t%s%s $(%s_FLAGS)%s -MMD -MP -c $< -o $@\n\n",
+                trace, compiler_launch(), t->name, pch_flags);
+    }
+    arena_release(&scratch_arena, mark);
+}
+
+static void write_makefile(FILE *mk) {
+    fprintf(mk, "all:");
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        fprintf(mk, " %s", target_output(t));
+    }
+    fprintf(mk, "\n\n.PHONY: all clean\n\n");
+
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (*t->name) write_target_rules(mk, t, write_makefile_target);
+    }
+
+    // Header dependencies written by the compiler next to each object
+    fprintf(mk, "-include");
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        fprintf(mk, " $(%s_OBJS:.o=.d)", t->name);
+        if (pch_owner(t) == t) fprintf(mk, " $(%s_PCH).d", t->name);
+    }
+    fprintf(mk, "\n\n");
+
+    // Generated inputs under CMakeFiles (response files, PCH headers) stay
+    fprintf(mk, "clean:\n\trm -f");
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        fprintf(mk, " %s $(%s_OBJS) $(%s_OBJS:.o=.d)", target_output(t), t->name, t->name);
+        if (pch_owner(t) == t) fprintf(mk, " $(%s_PCH) $(%s_PCH).d", t->name, t->name);
+    }
+    fprintf(mk, "\n\n");
+
+    // GNU make remakes the Makefile first when a script or glob changed
+    fprintf(mk, "Makefile:");
+    for (int i = 0; i < nscript_files; i++) fprintf(mk, " %s", script_files[i]);
+    if (has_configure_depends()) fprintf(mk, " %s", GLOB_STAMP);
+    fprintf(mk, "\n\t%s\n", getvar("CMAKE_COMMAND"));
+    if (has_configure_depends())
+        fprintf(mk, "\n%s: FORCE\n\t@%s --verify-globs\nFORCE:\n", GLOB_STAMP, getvar("CMAKE_COMMAND"));
+}
+
+// ---- Ninja Generator ----
+// Paths in build lines must escape ninja's special characters
+static void write_ninja_path(FILE *out, const char *path) {
+    for (const char *p = path; *p; p++) {
+        if (*p == '$' || *p == ' ' || *p == ':') fputc('$', out);
+        fputc(*p, out);
+    }
+}
+// Variable values only need '$' escaped
+static const char *ninja_escape(const char *s) {
+    if (!strchr(s, '$')) return s;
+    StrBuf b = {0};
+    for (; *s; s++) {
+        if (*s == '$') sb_putc(&b, '$');
+        sb_putc(&b, *s);
+    }
+    return sb_str(&b);
+}
+// The objects, precompiled header and output of one target
+static void write_ninja_target(FILE *nj, Target *t) {
+    const int trace = build_trace_enabled();
+    ArenaMark mark = arena_mark(&scratch_arena);
+    const char *flags = ninja_escape(spill_to_rsp(t, "flags", target_compile_flags(t)));
+    char obj[1024];
+
+    const Target *owner = pch_owner(t);
+    if (owner == t) {
+        write_pch_header(t);
+        fprintf(nj, "build ");
+        write_ninja_path(nj, pch_output(t));
+        fprintf(nj, ": pch ");
+        write_ninja_path(nj, pch_header(t));
+        fprintf(nj, "\n  flags =%s\n", flags);
+        if (trace) fprintf(nj, "  target = %s\n", t->name);
+    }
+    const char *pch_flags = pch_use_flags(t);
+    for (int j = 0; j < t->ncompile_src; j++) {
+        object_path(t, t->compile_srcs[j], obj, sizeof obj);
+        fprintf(nj, "build ");
+        write_ninja_path(nj, obj);
+        fprintf(nj, ": cc ");
+        write_ninja_path(nj, t->compile_srcs[j]);
+        if (owner) {
+            fprintf(nj, " | ");
+            write_ninja_path(nj, pch_output(owner));
+        }
+        fprintf(nj, "\n  flags =%s%s\n", flags, pch_flags);
+        if (trace) fprintf(nj, "  target = %s\n", t->name);
+    }
+
+    fprintf(nj, "build ");
+    write_ninja_path(nj, target_output(t));
+    if (strcmp(t->type, "STATIC") == 0) fprintf(nj, ": ar");
+    else if (strcmp(t->type, "SHARED") == 0) fprintf(nj, ": link_shared");
+    else fprintf(nj, ": link");
+    for (int j = 0; j < t->ncompile_src; j++) {
+        object_path(t, t->compile_srcs[j], obj, sizeof obj);
+        fputc(' ', nj);
+        write_ninja_path(nj, obj);
+    }
+    if (strcmp(t->type, "STATIC") == 0) {
+        fprintf(nj, "\n  ar = %s", archive_command(t));
+    } else {
+        const char *sep = " |";
+        for (int j = 0; j < t->nlink_item; j++) {
+            const Target *dep = link_dep(t->link_items[j]);
+            if (!dep) continue;
+            fprintf(nj, "%s ", sep);
+            write_ninja_path(nj, target_output(dep));
+            sep = "";
+        }
+        fprintf(nj, "\n  cflags = %s", target_c_flags(t));
+        fprintf(nj, "\n  libs =%s", target_link_flags(t));
+    }
+    if (trace) fprintf(nj, "\n  target = %s", t->name);
+    fprintf(nj, "\n\n");
+    arena_release(&scratch_arena, mark);
+}
+static void write_ninja(FILE *nj) {
+    fprintf(nj, "ninja_required_version = 1.5\n\n");
+    fprintf(nj, "cc = %s\n", getvar("CMAKE_C_COMPILER"));
+    fprintf(nj, "cc_launch = %s\n", compiler_launch());
+    fprintf(nj, "cflags = %s\n\n", getvar("CMAKE_C_FLAGS"));
+
+    // Traced builds name each edge's target in a $target binding
+    fprintf(nj, "rule cc\n"
+                "  command = %s$cc_launch $flags -MMD -MF $out.d -c $in -o $out\n"
+                "  depfile = $out.d\n"
+                "  deps = gcc\n"
+                "  description = CC $out\n\n", trace_prefix("CC", "$target", "$out"));
+    fprintf(nj, "rule pch\n"
+                "  command = %s$cc_launch $flags -x c-header -MMD -MF $out.d -c $in -o $out\n"
+                "  depfile = $out.d\n"
+                "  deps = gcc\n"
+                "  description = PCH $out\n\n", trace_prefix("PCH", "$target", "$out"));
+    fprintf(nj, "rule ar\n"
+                "  command = rm -f $out && %s$ar $out @$out.rsp\n"
+                "  rspfile = $out.rsp\n"
+                "  rspfile_content = $in\n"
+                "  description = AR $out\n\n", trace_prefix("AR", "$target", "$out"));
+    fprintf(nj, "rule link\n"
+                "  command = %s$cc $cflags -L. %s @$out.rsp -o $out\n"
+                "  rspfile = $out.rsp\n"
+                "  rspfile_content = $in $libs\n"
+                "  description = LINK $out\n\n", trace_prefix("LINK", "$target", "$out"), EXE_RULES);
+    fprintf(nj, "rule link_shared\n"
+                "  command = %s$cc -shared -fPIC $cflags -L. %s @$out.rsp -o $out\n"
+                "  rspfile = $out.rsp\n"
+                "  rspfile_content = $in $libs\n"
+                "  description = LINK $out\n\n", trace_prefix("LINK", "$target", "$out"), LINK_RULES);
+    // Regenerating only rewrites build.ninja when it changes, so restat lets
+    // ninja skip reloading the manifest after a no-op reconfigure
+    fprintf(nj, "rule regen\n"
+                "  command = %s -G Ninja\n"
+                "  description = Re-running Mini_CMake\n"
+                "  generator = 1\n"
+                "  restat = 1\n\n", getvar("CMAKE_COMMAND"));
+    // The verify edge never produces its output, so it runs on every build;
+    // restat keeps the stamp, and so build.ninja, clean unless a glob changed
+    if (has_configure_depends())
+        fprintf(nj, "rule verify_globs\n"
+                    "  command = %s --verify-globs\n"
+                    "  description = Checking CONFIGURE_DEPENDS globs\n"
+                    "  restat = 1\n\n"
+                    "build %s/verify_globs | %s: verify_globs\n\n", getvar("CMAKE_COMMAND"), OBJ_ROOT, GLOB_STAMP);
+    fprintf(nj, "build build.ninja: regen");
+    for (int i = 0; i < nscript_files; i++) {
+        fputc(' ', nj);
+        write_ninja_path(nj, script_files[i]);
+    }
+    if (has_configure_depends()) fprintf(nj, " | %s", GLOB_STAMP);
+    fprintf(nj, "\n\n");
+
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (*t->name) write_target_rules(nj, t, write_ninja_target);
+    }
+
+    fprintf(nj, "build all: phony");
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        fputc(' ', nj);
+        write_ninja_path(nj, target_output(t));
+    }
+    fprintf(nj, "\ndefault all\n");
+}
+
+// ---- Generator Table ----
+typedef struct {
+    const char *name;   // value of -G
+    const char *file;   // file the generator writes
+    const char *tool;   // what to run afterwards
+    void (*write)(FILE *out);
+} Generator;
+
+static const Generator generators[] = {
+    { "Unix Makefiles", "Makefile",    "make",  write_makefile },
+    { "Ninja",          "build.ninja", "ninja", write_ninja },
+};
+#define NGENERATORS ((int)(sizeof(generators) / sizeof(generators[0])))
+
+static const Generator *find_generator(const char *name) {
+    for (int i = 0; i < NGENERATORS; i++)
+        if (strcasecmp(generators[i].name, name) == 0) return &generators[i];
+    return NULL;
+}
+
+// Generate into a temporary file and only replace `path` when the contents
+// differ, so an unchanged configure leaves timestamps alone
+static int write_if_changed(const char *path, void (*write)(FILE *out)) {
+    FILE *tmp = tmpfile();
+    if (!tmp) return 0;
+    write(tmp);
+    long len = ftell(tmp);
+    rewind(tmp);
+
+    int same = 0;
+    FILE *old = fopen(path, "rb");
+    if (old) {
+        fseek(old, 0, SEEK_END);
+        if (ftell(old) == len) {
+            rewind(old);
+            char a[4096], b[4096];
+            size_t na, nb;
+            same = 1;
+            while ((na = fread(a, 1, sizeof a, tmp)) > 0) {
+                nb = fread(b, 1, na, old);
+                if (nb != na || memcmp(a, b, na) != 0) { same = 0; break; }
+            }
+            rewind(tmp);
+        }
+        fclose(old);
+    }
+
+    if (!same) {
+        FILE *out = fopen(path, "wb");
+        if (!out) { fclose(tmp); return 0; }
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof chunk, tmp)) > 0) fwrite(chunk, 1, n, out);
+        fclose(out);
+    }
+    fclose(tmp);
+    return 1;
+}
+
+// Absolute path of this executable, used by rules that re-run configure
+static void find_self(const char *argv0, char *buf, size_t buflen) {
+#ifdef _WIN32
+    if (!GetModuleFileNameA(NULL, buf, (DWORD)buflen)) snprintf(buf, buflen, "%s", argv0);
+#else
+    char tmp[PATH_MAX];
+    if (realpath("/proc/self/exe", tmp) || (strchr(argv0, '/') && realpath(argv0, tmp)))
+        snprintf(buf, buflen, "%s", tmp);
+    else
+        snprintf(buf, buflen, "%s", argv0);
+#endif
+}
+
+// ---- Built-in Build Executor ----
+// `--build -jN` turns targets[] into a DAG of compile, archive and link
+// actions and runs them on a work-stealing pool of worker threads.
+#ifndef _WIN32
+enum { ACT_COMPILE, ACT_PCH, ACT_ARCHIVE, ACT_LINK };
+
+typedef struct Action {
+    int kind;
+    Target *target;
+    char *output;
+    char *depfile;            // compile actions: header list written by gcc
+    char **inputs;            // files whose mtime is compared against output
+    int ninput;
+    char *command;
+
+    struct Action **users;    // actions waiting on this one
+    int nuser;
+    int pending;              // deps not yet finished, guarded by pool lock
+    long priority;            // weighted length of the longest path to a sink
+
+    long long start_us;       // wall clock, both 0 if the action was up to date
+    long long end_us;
+    int status;               // exit status of the command
+    long long path_us;        // measured time of the longest path to a sink
+} Action;
+
+static Action **actions = NULL;
+static int naction = 0;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Action **items;           // owner pops from the end, thieves take from the front
+    int head, tail, cap;
+} WorkDeque;
+
+static struct {
+    WorkDeque *deques;
+    int nworker;
+    pthread_mutex_t lock;     // protects the counters below and Action.pending
+    pthread_cond_t wake;
+    int remaining;            // actions not finished yet
+    int queued;               // actions sitting in some deque
+    int started;              // actions that ran a command, for progress output
+    int failed;
+} pool;
+
+static void deque_push(WorkDeque *d, Action *a) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        // Slide live items to the front before growing
+        memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(Action *));
+        d->tail -= d->head;
+        d->head = 0;
+        if (d->tail == d->cap) {
+            d->cap = d->cap ? d->cap * 2 : 16;
+            d->items = realloc(d->items, d->cap * sizeof(Action *));
+        }
+    }
+    d->items[d->tail++] = a;
+    pthread_mutex_unlock(&d->lock);
+}
+static Action *deque_pop(WorkDeque *d) {
+    Action *a = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) a = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return a;
+}
+static Action *deque_steal(WorkDeque *d) {
+    Action *a = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) a = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return a;
+}
+
+static char *str_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *s = malloc(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(s, n + 1, fmt, ap);
+    va_end(ap);
+    return s;
+}
+// True if any prerequisite listed in a gcc depfile is newer than `out_time`
+static int depfile_newer(const char *depfile, long long out_time) {
+    FILE *f = fopen(depfile, "r");
+    if (!f) return 1;
+    int c, newer = 0, seen_colon = 0;
+    char path[4096];
+    size_t len = 0;
+    while (!newer) {
+        c = fgetc(f);
+        if (c == '\\') {
+            int next = fgetc(f);
+            if (next == '\n') c = ' ';
+            else if (next == '\r') { fgetc(f); c = ' '; }
+            else if (next == ' ') { if (len < sizeof path - 1) path[len++] = ' '; continue; }
+            else { if (next != EOF) ungetc(next, f); }
+        }
+        if (c == EOF || c == ' ' || c == '\t' || c == '\n') {
+            path[len] = 0;
+            if (len && seen_colon) {
+                long long t = file_mtime(path);
+                if (t < 0 || t > out_time) newer = 1;
+            }
+            len = 0;
+            // The -MP phony rules follow the first rule; we only need the first
+            if (c == EOF || (c == '\n' && seen_colon)) break;
+            continue;
+        }
+        if (c == ':' && !seen_colon) {
+            int next = fgetc(f);
+            if (next == ' ' || next == '\n' || next == EOF) { seen_colon = 1; len = 0; continue; }
+            ungetc(next, f);
+        }
+        if (len < sizeof path - 1) path[len++] = (char)c;
+    }
+    fclose(f);
+    return newer;
+}
+static int action_dirty(const Action *a) {
+    long long out = file_mtime(a->output);
+    if (out < 0) return 1;
+    for (int i = 0; i < a->ninput; i++) {
+        long long t = file_mtime(a->inputs[i]);
+        if (t < 0 || t > out) return 1;
+    }
+    if (a->depfile) return depfile_newer(a->depfile, out);
+    return 0;
+}
+
+static Action *new_action(int kind, Target *t, const char *output) {
+    Action *a = calloc(1, sizeof(Action));
+    a->kind = kind;
+    a->target = t;
+    a->output = strdup(output);
+    actions = realloc(actions, (naction + 1) * sizeof(Action *));
+    actions[naction++] = a;
+    return a;
+}
+static void action_depends(Action *a, Action *dep) {
+    dep->users = realloc(dep->users, (dep->nuser + 1) * sizeof(Action *));
+    dep->users[dep->nuser++] = a;
+    a->pending++;
+}
+// Longest path to a sink, weighting links over compiles so that chains of
+// target_link_libraries are started as early as possible
+static long action_priority(Action *a) {
+    if (a->priority) return a->priority;
+    long best = 0;
+    for (int i = 0; i < a->nuser; i++) {
+        long p = action_priority(a->users[i]);
+        if (p > best) best = p;
+    }
+    a->priority = best + (a->kind == ACT_LINK ? 4 : a->kind == ACT_ARCHIVE ? 2 : 1);
+    return a->priority;
+}
+
+// Also resets the worker pool, so a process can build more than once
+static void free_action_graph(void) {
+    for (int i = 0; i < naction; i++) {
+        free(actions[i]->output);
+        free(actions[i]->depfile);
+        free(actions[i]->command);
+        free(actions[i]->users);
+        free(actions[i]);
+    }
+    free(actions);
+    actions = NULL;
+    naction = 0;
+    // Only run_build() sets the pool up; before that, and for --trace-report, there is none
+    if (!pool.deques) return;
+    for (int i = 0; i < pool.nworker; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].items);
+    }
+    free(pool.deques);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.wake);
+    memset(&pool, 0, sizeof pool);
+}
+static void build_action_graph(void) {
+    free_action_graph();
+    Action **final = calloc(ntarget > 0 ? ntarget : 1, sizeof(Action *));
+    const char *cc = getvar("CMAKE_C_COMPILER");
+    char *launch = str_printf("%s", compiler_launch());
+    char obj[1024];
+
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        int kind = strcmp(t->type, "STATIC") == 0 ? ACT_ARCHIVE : ACT_LINK;
+        final[i] = new_action(kind, t, target_output(t));
+    }
+
+    // Precompiled headers first, other targets may reuse them
+    Action **pch = calloc(ntarget > 0 ? ntarget : 1, sizeof(Action *));
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!final[i] || pch_owner(t) != t) continue;
+        ArenaMark mark = arena_mark(&scratch_arena);
+        write_pch_header(t);
+        const char *header = pch_header(t);
+        Action *p = pch[i] = new_action(ACT_PCH, t, pch_output(t));
+        add_string(&p->inputs, &p->ninput, header);
+        add_string(&p->inputs, &p->ninput, flags_stamp(t));
+        p->depfile = str_printf("%s.d", p->output);
+        p->command = str_printf("%s %s -x c-header -MMD -MP -MF %s -c %s -o %s", launch,
+                                spill_to_rsp(t, "flags", target_compile_flags(t)), p->depfile, header, p->output);
+        arena_release(&scratch_arena, mark);
+    }
+
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        Action *link = final[i];
+        if (!link) continue;
+        ArenaMark mark = arena_mark(&scratch_arena);
+        const char *flags = spill_to_rsp(t, "flags", target_compile_flags(t));
+        const char *objs = target_objects(t);
+        const Target *owner = pch_owner(t);
+        Action *use_pch = owner ? pch[owner - targets] : NULL;
+        const char *pch_flags = pch_use_flags(t);
+        const char *stamp = flags_stamp(t);
+
+        for (int j = 0; j < t->ncompile_src; j++) {
+            object_path(t, t->compile_srcs[j], obj, sizeof obj);
+            Action *c = new_action(ACT_COMPILE, t, obj);
+            add_string(&c->inputs, &c->ninput, t->compile_srcs[j]);
+            add_string(&c->inputs, &c->ninput, stamp);
+            if (use_pch) {
+                add_string(&c->inputs, &c->ninput, use_pch->output);
+                action_depends(c, use_pch);
+            }
+            c->depfile = str_printf("%.*s.d", (int)(strlen(obj) - 2), obj);
+            c->command = str_printf("%s %s%s -MMD -MP -c %s -o %s", launch, flags, pch_flags,
+                                    t->compile_srcs[j], obj);
+            add_string(&link->inputs, &link->ninput, obj);
+            action_depends(link, c);
+        }
+
+        if (link->kind == ACT_ARCHIVE) {
+            link->command = str_printf("rm -f %s && %s %s%s", link->output, archive_command(t), link->output,
+                                       spill_to_rsp(t, "archive", objs));
+        } else {
+            // Depend on the outputs of everything on the link line that is built here
+            for (int j = 0; j < t->nlink_item; j++) {
+                Target *dep = find_target(t->link_items[j]);
+                if (dep && final[dep - targets]) {
+                    add_string(&link->inputs, &link->ninput, final[dep - targets]->output);
+                    action_depends(link, final[dep - targets]);
+                }
+            }
+            StrBuf args = {0};
+            sb_puts(&args, objs);
+            sb_puts(&args, target_link_flags(t));
+            const char *line = spill_to_rsp(t, "link", sb_str(&args));
+            if (strcmp(t->type, "SHARED") == 0)
+                link->command = str_printf("%s -shared -fPIC %s -L. %s%s -o %s", cc,
+                                           target_c_flags(t), LINK_RULES, line, link->output);
+            else
+                link->command = str_printf("%s %s -L. %s%s -o %s", cc,
+                                           target_c_flags(t), EXE_RULES, line, link->output);
+        }
+        arena_release(&scratch_arena, mark);
+    }
+    free(final);
+    free(pch);
+    free(launch);
+
+    for (int i = 0; i < naction; i++) action_priority(actions[i]);
+}
+
+static int cmp_priority_asc(const void *a, const void *b) {
+    long pa = (*(Action * const *)a)->priority, pb = (*(Action * const *)b)->priority;
+    return pa < pb ? -1 : pa > pb;
+}
+// Hand newly ready actions to a worker; the highest priority ends up on top
+static void enqueue_ready(int worker, Action **ready, int nready) {
+    if (!nready) return;
+    qsort(ready, nready, sizeof(Action *), cmp_priority_asc);
+    // Counted before they are visible, so a thief can never take queued below 0
+    pthread_mutex_lock(&pool.lock);
+    pool.queued += nready;
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < nready; i++) deque_push(&pool.deques[worker], ready[i]);
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+}
+static int run_command(const char *cmd) {
+    pid_t pid;
+    char *const args[] = { "/bin/sh", "-c", (char *)cmd, NULL };
+    extern char **environ;
+    // The child writes straight to fd 1; what we printed must come first
+    fflush(stdout);
+    if (posix_spawn(&pid, "/bin/sh", NULL, NULL, args, environ) != 0) return -1;
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+static const char *action_kind_name(int kind) {
+    return kind == ACT_COMPILE ? "CC" : kind == ACT_PCH ? "PCH" : kind == ACT_ARCHIVE ? "AR" : "LINK";
+}
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+static void run_action(Action *a, int worker) {
+    int rc = 0;
+    if (action_dirty(a)) {
+        pthread_mutex_lock(&pool.lock);
+        printf("[%d/%d] %s %s\n", ++pool.started, naction, action_kind_name(a->kind), a->output);
+        fflush(stdout);
+        pthread_mutex_unlock(&pool.lock);
+        make_parent_dirs(a->output);
+        a->start_us = now_us();
+        rc = a->status = run_command(a->command);
+        a->end_us = now_us();
+    }
+
+    Action **ready = malloc((a->nuser ? a->nuser : 1) * sizeof(Action *));
+    int nready = 0;
+    pthread_mutex_lock(&pool.lock);
+    if (rc != 0) {
+        printf("FAILED: %s\n%s\n", a->output, a->command);
+        pool.failed = 1;
+    }
+    pool.remaining--;
+    if (!pool.failed) {
+        for (int i = 0; i < a->nuser; i++)
+            if (--a->users[i]->pending == 0) ready[nready++] = a->users[i];
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    enqueue_ready(worker, ready, nready);
+    free(ready);
+}
+static Action *find_work(int worker) {
+    Action *a = deque_pop(&pool.deques[worker]);
+    for (int i = 1; !a && i < pool.nworker; i++)
+        a = deque_steal(&pool.deques[(worker + i) % pool.nworker]);
+    return a;
+}
+static void *worker_main(void *arg) {
+    int worker = (int)(intptr_t)arg;
+    for (;;) {
+        Action *a = find_work(worker);
+        pthread_mutex_lock(&pool.lock);
+        if (a) {
+            pool.queued--;
+            int skip = pool.failed;
+            pthread_mutex_unlock(&pool.lock);
+            if (!skip) run_action(a, worker);
+            pthread_mutex_lock(&pool.lock);
+            pthread_cond_broadcast(&pool.wake);
+            pthread_mutex_unlock(&pool.lock);
+            continue;
+        }
+        // Nothing to pop or steal; sleep until work shows up or the build ends
+        while (pool.queued == 0 && pool.remaining > 0 && !pool.failed)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        int finished = pool.remaining == 0 || (pool.failed && pool.queued == 0);
+        pthread_mutex_unlock(&pool.lock);
+        if (finished) return NULL;
+    }
+}
+
+static int cmp_priority_desc(const void *a, const void *b) {
+    return -cmp_priority_asc(a, b);
+}
+static int run_build(int jobs) {
+    build_action_graph();
+    if (naction == 0) { puts("Nothing to build."); return 0; }
+    if (jobs < 1) jobs = 1;
+
+    pool.nworker = jobs;
+    pool.deques = calloc(jobs, sizeof(WorkDeque));
+    for (int i = 0; i < jobs; i++) pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pool.remaining = naction;
+
+    // Deal the initially ready actions round-robin, most critical first
+    Action **ready = malloc(naction * sizeof(Action *));
+    int nready = 0;
+    for (int i = 0; i < naction; i++)
+        if (actions[i]->pending == 0) ready[nready++] = actions[i];
+    qsort(ready, nready, sizeof(Action *), cmp_priority_desc);
+    for (int w = 0; w < jobs; w++) {
+        Action **mine = malloc((nready / jobs + 1) * sizeof(Action *));
+        int nmine = 0;
+        for (int i = w; i < nready; i += jobs) mine[nmine++] = ready[i];
+        enqueue_ready(w, mine, nmine);
+        free(mine);
+    }
+    free(ready);
+
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    for (int i = 0; i < jobs; i++)
+        pthread_create(&threads[i], NULL, worker_main, (void *)(intptr_t)i);
+    for (int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (pool.failed) { puts("Build failed."); return 1; }
+    puts("Build finished.");
+    return 0;
+}
+#endif
+
+// ---- Profile-Guided Optimization ----
+// CMAKE_PGO_PHASE=GENERATE builds instrumented objects that write their
+// profiles to CMakeFiles/<target>.dir/pgo; CMAKE_PGO_PHASE=USE rebuilds them
+// with those profiles. `--pgo` runs both builds with the training command in
+// between.
+#ifndef _WIN32
+// gcc names a profile after the object's absolute path with '/' as '#'
+static const char *pgo_profile(const Target *t, const char *obj, const char *cwd) {
+    StrBuf b = {0};
+    sb_puts(&b, pgo_dir(t));
+    sb_putc(&b, '/');
+    for (const char *p = cwd; *p; p++) sb_putc(&b, *p == '/' ? '#' : *p);
+    sb_putc(&b, '#');
+    for (const char *p = obj; *p && strcmp(p, ".o") != 0; p++) sb_putc(&b, *p == '/' ? '#' : *p);
+    sb_puts(&b, ".gcda");
+    return sb_str(&b);
+}
+// Lists translation units whose profile is missing, or older than the
+// source or a header it includes. Returns how many there are.
+static int report_profiles(void) {
+    char cwd[4096], obj[1024], dep[1024];
+    if (!getcwd(cwd, sizeof cwd)) return 0;
+    int total = 0, bad = 0;
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        if (!*t->name) continue;
+        for (int j = 0; j < t->ncompile_src; j++) {
+            ArenaMark mark = arena_mark(&scratch_arena);
+            object_path(t, t->compile_srcs[j], obj, sizeof obj);
+            snprintf(dep, sizeof dep, "%.*s.d", (int)(strlen(obj) - 2), obj);
+            long long when = file_mtime(pgo_profile(t, obj, cwd));
+            const char *problem = when < 0 ? "missing" : depfile_newer(dep, when) ? "stale" : NULL;
+            if (problem) {
+                printf("--   %s profile: %s (%s)\n", problem, t->compile_srcs[j], t->name);
+                bad++;
+            }
+            total++;
+            arena_release(&scratch_arena, mark);
+        }
+    }
+    printf("-- PGO profiles: %d of %d translation units up to date\n", total - bad, total);
+    return bad;
+}
+// Old counters would be merged into the new run's, so training starts clean
+static void clear_profiles(void) {
+    for (int i = 0; i < ntarget; i++) {
+        if (!*targets[i].name) continue;
+        ArenaMark mark = arena_mark(&scratch_arena);
+        const char *dir = pgo_dir(&targets[i]);
+        DIR *dp = opendir(dir);
+        struct dirent *entry;
+        while (dp && (entry = readdir(dp))) {
+            if (!has_suffix(entry->d_name, ".gcda")) continue;
+            StrBuf path = {0};
+            sb_puts(&path, dir);
+            sb_putc(&path, '/');
+            sb_puts(&path, entry->d_name);
+            unlink(sb_str(&path));
+        }
+        if (dp) closedir(dp);
+        arena_release(&scratch_arena, mark);
+    }
+}
+// --pgo: instrumented build, CMAKE_PGO_TRAINING_COMMAND, optimized build
+static int run_pgo(int jobs) {
+    const char *train = arena_strdup(&config_arena, getvar_command("CMAKE_PGO_TRAINING_COMMAND"));
+    if (!*train) {
+        puts("--pgo needs CMAKE_PGO_TRAINING_COMMAND to be set.");
+        return 1;
+    }
+    puts("-- PGO phase 1/3: instrumented build");
+    setvar("CMAKE_PGO_PHASE", "GENERATE");
+    if (run_build(jobs) != 0) return 1;
+
+    printf("-- PGO phase 2/3: training: %s\n", train);
+    clear_profiles();
+    int rc = run_command(train);
+    if (rc != 0) {
+        printf("Training command failed with exit code %d.\n", rc);
+        return 1;
+    }
+    report_profiles();
+
+    puts("-- PGO phase 3/3: optimized build");
+    setvar("CMAKE_PGO_PHASE", "USE");
+    return run_build(jobs);
+}
+#endif
+
+// ---- Configure ----
+// Scripts are linked into blocks once when loaded (compile_script) and run
+// from that form; loop and function bodies are never tokenized again.
+typedef void (*CommandFn)(int argc, char **argv);
+static const struct {
+    const char *name;
+    CommandFn fn;       // NULL: accepted and ignored
+} builtin_commands[] = {
+    { "set", cmd_set },
+    { "unset", cmd_unset },
+    { "list", cmd_list },
+    { "project", cmd_project },
+    { "file", cmd_file },
+    { "add_definitions", cmd_add_definitions },
+    { "add_executable", cmd_add_executable },
+    { "add_library", cmd_add_library },
+    { "include_directories", cmd_include_directories_global },
+    { "target_include_directories", cmd_include_dirs },
+    { "target_compile_definitions", cmd_target_compile_definitions },
+    { "target_link_libraries", cmd_target_link_libs },
+    { "target_precompile_headers", cmd_target_precompile_headers },
+    { "set_target_properties", cmd_set_target_properties },
+    { "set_source_files_properties", cmd_set_source_files_properties },
+    { "include", cmd_include },
+    { "cmake_minimum_required", cmd_cmake_minimum_required },
+    { "message", cmd_message },
+    { "add_compile_options", cmd_add_compile_options },
+    { "add_subdirectory", cmd_add_subdirectory },
+    // --- STUBS for advanced features ---
+    { "fetchcontent_declare", NULL },
+    { "fetchcontent_makeavailable", NULL },
+    { "find_package", NULL },
+    { "target_link_options", NULL },
+};
+static const char *const block_commands[OP_BUILTIN] = {
+    "if", "elseif", "else", "endif", "foreach", "endforeach", "while", "endwhile",
+    "function", "endfunction", "macro", "endmacro", "break", "continue", "return",
+};
+static NameIndex command_index;     // lowercase name -> OP_*
+
+// A function() or macro(): its body is cmds[body..end) of the defining script
+typedef struct {
+    const char *id;     // lowercase name, interned
+    const Script *script;
+    int body, end;
+    char **params;
+    int nparam;
+    int is_macro;
+    int dir;            // --watch: the WatchDir that defined it
+} Function;
+static THREAD_LOCAL Function *functions = NULL;
+static THREAD_LOCAL int nfunction = 0;
+static THREAD_LOCAL NameIndex function_index;    // lowercase name -> functions[]
+static const Function *outer_function(const char *id);
+
+// Unwinding for break(), continue() and return()
+enum { FLOW_NORMAL, FLOW_BREAK, FLOW_CONTINUE, FLOW_RETURN };
+static THREAD_LOCAL int flow = FLOW_NORMAL;
+static THREAD_LOCAL int loop_depth = 0, call_depth = 0;
+#define MAX_CALL_DEPTH 1000
+
+static const char *lower_id(const char *name, size_t len) {
+    char buf[256];
+    if (len >= sizeof buf) return intern_n(name, len);
+    for (size_t i = 0; i < len; i++) buf[i] = (char)tolower((unsigned char)name[i]);
+    return intern_n(buf, len);
+}
+static int command_op(const char *id) {
+    if (!command_index.count) {
+        for (int i = 0; i < OP_BUILTIN; i++)
+            name_index_put(&command_index, lower_id(block_commands[i], strlen(block_commands[i])), i);
+        for (size_t i = 0; i < sizeof builtin_commands / sizeof builtin_commands[0]; i++) {
+            const char *name = builtin_commands[i].name;
+            name_index_put(&command_index, lower_id(name, strlen(name)), OP_BUILTIN + (int)i);
+        }
+    }
+    int op = name_index_get(&command_index, id);
+    return op >= 0 ? op : OP_CALL;
+}
+static const Function *find_function(const char *id) {
+    int idx = name_index_get(&function_index, id);
+    if (idx < 0) return outer_function(id);
+    watch_touch(functions[idx].dir);
+    return &functions[idx];
+}
+// The entry for id, added empty if there is none
+static Function *function_slot(const char *id) {
+    int idx = name_index_get(&function_index, id);
+    if (idx < 0) {
+        functions = arena_grow(&config_arena, functions, nfunction, sizeof(Function));
+        idx = nfunction++;
+        name_index_put(&function_index, id, idx);
+    }
+    return &functions[idx];
+}
+static int command_exists(const char *name) {
+    const char *id = lower_id(name, strlen(name));
+    return command_op(id) != OP_CALL || find_function(id) != NULL;
+}
+
+// Resolves each command's op and links if/elseif/else/endif chains and the
+// other blocks to their closing command. 0 on unbalanced blocks.
+static int compile_script(Script *s) {
+    static const int closer_of[OP_BUILTIN] = {
+        [OP_IF] = OP_ENDIF, [OP_ELSEIF] = OP_ENDIF, [OP_ELSE] = OP_ENDIF,
+        [OP_FOREACH] = OP_ENDFOREACH, [OP_WHILE] = OP_ENDWHILE,
+        [OP_FUNCTION] = OP_ENDFUNCTION, [OP_MACRO] = OP_ENDMACRO,
+    };
+    int *first = malloc((s->ncmd + 1) * sizeof(int));    // opening command of each open block
+    int *branch = malloc((s->ncmd + 1) * sizeof(int));   // its latest if() branch
+    int depth = 0, ok = 1;
+    for (int n = 0; n < s->ncmd && ok; n++) {
+        Command *c = &s->cmds[n];
+        c->id = lower_id(c->name, c->name_len);
+        c->op = command_op(c->id);
+        c->next = c->end = -1;
+        switch (c->op) {
+        case OP_IF: case OP_FOREACH: case OP_WHILE: case OP_FUNCTION: case OP_MACRO:
+            first[depth] = branch[depth] = n;
+            depth++;
+            break;
+        case OP_ELSEIF: case OP_ELSE:
+            if (!depth || closer_of[s->cmds[branch[depth - 1]].op] != OP_ENDIF ||
+                s->cmds[branch[depth - 1]].op == OP_ELSE) {
+                script_error(s, c->line, c->op == OP_ELSE ? "else() without if()" : "elseif() without if()");
+                ok = 0;
+                break;
+            }
+            s->cmds[branch[depth - 1]].next = n;
+            branch[depth - 1] = n;
+            break;
+        case OP_ENDIF: case OP_ENDFOREACH: case OP_ENDWHILE: case OP_ENDFUNCTION: case OP_ENDMACRO:
+            if (!depth || closer_of[s->cmds[first[depth - 1]].op] != c->op) {
+                char msg[64];
+                snprintf(msg, sizeof msg, "%s() without a matching block", block_commands[c->op]);
+                script_error(s, c->line, msg);
+                ok = 0;
+                break;
+            }
+            depth--;
+            s->cmds[branch[depth]].next = n;
+            for (int b = first[depth]; b != n; b = s->cmds[b].next) s->cmds[b].end = n;
+            break;
+        }
+    }
+    if (ok && depth) {
+        char msg[64];
+        const Command *c = &s->cmds[first[depth - 1]];
+        snprintf(msg, sizeof msg, "%s() is never closed", block_commands[c->op]);
+        script_error(s, c->line, msg);
+        ok = 0;
+    }
+    free(first);
+    free(branch);
+    return ok;
+}
+
+static void command_error(const Script *s, const Command *c, const char *msg) {
+    fprintf(message_out(), "CMake Error at %s:%d (%.*s): %s\n", s->path, c->line, (int)c->name_len, c->name, msg);
+    configure_error = 1;
+}
+
+static void run_commands(const Script *s, int from, int to);
+static int run_subdirectories(const Script *s, int from, int to, int *last);
+
+static int command_condition(const Script *s, const Command *c) {
+    ArenaMark mark = arena_mark(&scratch_arena);
+    char **argv;
+    int argc = expand_command(c, &argv);
+    int val = eval_condition(argc, argv);
+    if (val < 0) {
+        StrBuf msg = {0};
+        sb_puts(&msg, "invalid condition: ");
+        sb_puts(&msg, join_args(argc, argv, " "));
+        command_error(s, c, sb_str(&msg));
+        val = 0;
+    }
+    arena_release(&scratch_arena, mark);
+    return val;
+}
+// Runs the first branch of the if() chain at cmds[n] whose condition holds
+static void run_if(const Script *s, int n) {
+    for (int b = n; s->cmds[b].op != OP_ENDIF && !configure_error; b = s->cmds[b].next) {
+        const Command *c = &s->cmds[b];
+        if (c->op == OP_ELSE || command_condition(s, c)) {
+            run_commands(s, b + 1, c->next);
+            return;
+        }
+    }
+}
+// Runs a loop body once; 0 if the loop should stop
+static int run_loop_body(const Script *s, const Command *c) {
+    loop_depth++;
+    run_commands(s, c - s->cmds + 1, c->end);
+    loop_depth--;
+    if (flow == FLOW_BREAK || flow == FLOW_CONTINUE) {
+        int stop = flow == FLOW_BREAK;
+        flow = FLOW_NORMAL;
+        return !stop;
+    }
+    return flow == FLOW_NORMAL && !configure_error;
+}
+// foreach(var a b c), foreach(var RANGE [start] stop [step]) and
+// foreach(var IN LISTS list... ITEMS item...). The loop variable gets its
+// old value back afterwards.
+static void run_foreach(const Script *s, const Command *c, int argc, char **argv) {
+    if (argc < 1) return;
+    const char *var = argv[0];
+    Value old = saved_value(find_value(var, strlen(var)));
+
+    if (argc > 1 && strcmp(argv[1], "RANGE") == 0) {
+        long start = 0, stop = 0, step = 1;
+        if (argc == 3) stop = strtol(argv[2], NULL, 10);
+        else if (argc >= 4) {
+            start = strtol(argv[2], NULL, 10);
+            stop = strtol(argv[3], NULL, 10);
+            if (argc >= 5) step = strtol(argv[4], NULL, 10);
+        }
+        if (step <= 0 || stop < start) {
+            command_error(s, c, "invalid RANGE");
+        } else {
+            for (long i = start; i <= stop; i += step) {
+                char num[32];
+                snprintf(num, sizeof num, "%ld", i);
+                setvar(var, num);
+                if (!run_loop_body(s, c)) break;
+            }
+        }
+    } else {
+        char **items = argv + 1;
+        int nitem = argc - 1;
+        if (argc > 1 && strcmp(argv[1], "IN") == 0) {
+            items = NULL;
+            nitem = 0;
+            int lists = 0;
+            for (int i = 2; i < argc; i++) {
+                if (strcmp(argv[i], "LISTS") == 0) lists = 1;
+                else if (strcmp(argv[i], "ITEMS") == 0) lists = 0;
+                else if (lists) nitem = list_items(argv[i], &items, nitem);
+                else {
+                    items = arena_grow(&scratch_arena, items, nitem, sizeof(char *));
+                    items[nitem++] = argv[i];
+                }
+            }
+        }
+        for (int i = 0; i < nitem; i++) {
+            setvar(var, items[i]);
+            if (!run_loop_body(s, c)) break;
+        }
+    }
+    setvar_value(var, old);
+}
+static void run_while(const Script *s, const Command *c) {
+    while (!configure_error && command_condition(s, c) && run_loop_body(s, c)) {}
+}
+static void define_function(const Script *s, const Command *c, int argc, char **argv) {
+    if (argc < 1) {
+        command_error(s, c, "a name is required");
+        return;
+    }
+    const char *id = lower_id(argv[0], strlen(argv[0]));
+    // Redefining a function from outside the current directory changes what
+    // the directories that called it got
+    int old = watching ? name_index_get(&function_index, id) : -1;
+    if (old >= 0 && !watch_inside(functions[old].dir, watch_cur)) {
+        watch_touch(functions[old].dir);
+        watch_pin(1);
+    }
+    Function *f = function_slot(id);
+    memset(f, 0, sizeof *f);
+    f->id = id;
+    f->dir = watch_cur;
+    f->script = s;
+    f->body = c - s->cmds + 1;
+    f->end = c->end;
+    f->is_macro = c->op == OP_MACRO;
+    for (int i = 1; i < argc; i++) add_string(&f->params, &f->nparam, argv[i]);
+    DPRINTF("%s %s: %d parameters\n", block_commands[c->op], argv[0], f->nparam);
+}
+// A function runs in its own variable scope; a macro's arguments are set
+// around its body and everything else it sets stays with the caller
+static void call_function(const Script *s, const Command *c, const Function *f, int argc, char **argv) {
+    if (argc < f->nparam) {
+        command_error(s, c, "called with fewer arguments than it takes");
+        return;
+    }
+    if (call_depth >= MAX_CALL_DEPTH) {
+        command_error(s, c, "maximum recursion depth exceeded");
+        return;
+    }
+    char num[32];
+    int nbound = f->nparam + argc + 3;
+    const char **names = malloc(nbound * sizeof(char *));
+    Value *values = malloc(nbound * sizeof(Value));
+    int n = 0;
+    for (int i = 0; i < f->nparam; i++) {
+        names[n] = f->params[i];
+        values[n++] = string_value(argv[i]);
+    }
+    snprintf(num, sizeof num, "%d", argc);
+    names[n] = "ARGC";
+    values[n++] = string_value(num);
+    names[n] = "ARGV";
+    values[n++] = list_value(argc, argv);
+    names[n] = "ARGN";
+    values[n++] = list_value(argc - f->nparam, argv + f->nparam);
+    for (int i = 0; i < argc; i++) {
+        snprintf(num, sizeof num, "ARGV%d", i);
+        names[n] = arena_strdup(&scratch_arena, num);
+        values[n++] = string_value(argv[i]);
+    }
+
+    int saved_loops = loop_depth;
+    loop_depth = 0;
+    call_depth++;
+    if (f->is_macro) {
+        Value *old = malloc(n * sizeof(Value));
+        for (int i = 0; i < n; i++) {
+            old[i] = saved_value(find_value(names[i], strlen(names[i])));
+            setvar_value(names[i], values[i]);
+        }
+        run_commands(f->script, f->body, f->end);
+        for (int i = n - 1; i >= 0; i--) setvar_value(names[i], old[i]);
+        free(old);
+    } else {
+        Scope scope;
+        push_scope(&scope);
+        for (int i = 0; i < n; i++) setvar_value(names[i], values[i]);
+        run_commands(f->script, f->body, f->end);
+        if (flow == FLOW_RETURN) flow = FLOW_NORMAL;
+        pop_scope();
+    }
+    call_depth--;
+    loop_depth = saved_loops;
+    free(names);
+    free(values);
+}
+static void run_commands(const Script *s, int from, int to) {
+    for (int n = from; n < to && !configure_error && flow == FLOW_NORMAL; n++) {
+        const Command *c = &s->cmds[n];
+        long long start = 0, outer_nested = 0;
+        if (prof.enabled) {
+            start = monotonic_us();
+            outer_nested = prof.nested_us;
+            prof.nested_us = 0;
+        }
+        ArenaMark mark = arena_mark(&scratch_arena);
+        char **argv;
+        int argc;
+        switch (c->op) {
+        case OP_IF:
+            run_if(s, n);
+            n = c->end;
+            break;
+        case OP_WHILE:
+            run_while(s, c);
+            n = c->end;
+            break;
+        case OP_FOREACH:
+        case OP_FUNCTION:
+        case OP_MACRO:
+            argc = expand_command(c, &argv);
+            if (c->op == OP_FOREACH) run_foreach(s, c, argc, argv);
+            else define_function(s, c, argc, argv);
+            n = c->end;
+            break;
+        case OP_BREAK:
+        case OP_CONTINUE:
+            if (!loop_depth) command_error(s, c, "called outside of a foreach() or while() loop");
+            else flow = c->op == OP_BREAK ? FLOW_BREAK : FLOW_CONTINUE;
+            break;
+        case OP_RETURN:
+            flow = FLOW_RETURN;
+            break;
+        case OP_CALL: {
+            const Function *f = find_function(c->id);
+            if (!f) {
+                DPRINTF("Unknown or skipped command: %.*s\n", (int)c->name_len, c->name);
+                break;
+            }
+            argc = expand_command(c, &argv);
+            call_function(s, c, f, argc, argv);
+            break;
+        }
+        default:
+            if (c->op < OP_BUILTIN) break;      // a closing command, reached only by malformed input
+            if (!builtin_commands[c->op - OP_BUILTIN].fn) {
+                DPRINTF("Skipping %.*s\n", (int)c->name_len, c->name);
+                break;
+            }
+            // Sibling add_subdirectory() calls may run at the same time
+            if (builtin_commands[c->op - OP_BUILTIN].fn == cmd_add_subdirectory && n + 1 < to &&
+                s->cmds[n + 1].op == c->op && run_subdirectories(s, n, to, &n))
+                break;
+            argc = expand_command(c, &argv);
+            builtin_commands[c->op - OP_BUILTIN].fn(argc, argv);
+        }
+        arena_release(&scratch_arena, mark);
+        if (prof.enabled) {
+            long long elapsed = monotonic_us() - start;
+            ProfileEntry *e = profile_entry(&prof.cmds, &prof.ncmd, c->name, c->name_len);
+            e->us += elapsed - prof.nested_us;
+            e->count++;
+            prof.nested_us = outer_nested + elapsed;
+        }
+    }
+}
+static void run_script(const Script *s) {
+    run_commands(s, 0, s->ncmd);
+    // return() leaves the current file
+    if (flow == FLOW_RETURN) flow = FLOW_NORMAL;
+}
+// Loads and runs a script; 0 if it could not be read
+static int run_script_file(const char *path) {
+    long long start = prof.enabled ? monotonic_us() : 0;
+    Script *s = load_script(path);
+    if (s) run_script(s);
+    if (prof.enabled) {
+        ProfileEntry *e = profile_entry(&prof.scripts, &prof.nscript, path, strlen(path));
+        e->us += monotonic_us() - start;
+        e->count++;
+    }
+    return s != NULL;
+}
+
+// The variables visible now, copied into a scope of their own
+static Scope *flatten_scope(void) {
+    Scope *flat = arena_alloc(&config_arena, sizeof(Scope));
+    memset(flat, 0, sizeof *flat);
+    NameIndex seen = {0};
+    for (Scope *s = cur_scope; s; s = s->parent)
+        for (int i = 0; i < s->nvars; i++) {
+            const char *k = s->vars[i].key;
+            if (name_index_get(&seen, k) >= 0) continue;
+            name_index_put(&seen, k, 0);
+            scope_put(flat, k, saved_value(&s->vars[i].val));
+        }
+    free(seen.keys);
+    free(seen.vals);
+    return flat;
+}
+static void watch_counts(int *n) {
+    n[WATCH_DIRS] = nwatch_dir;
+    n[WATCH_TARGETS] = ntarget;
+    n[WATCH_FUNCTIONS] = nfunction;
+    n[WATCH_SCRIPTS] = nscript_files;
+    n[WATCH_GLOBS] = nglob_record;
+}
+// Records a directory being entered; dir is NULL for the top one
+static int watch_enter(const char *dir) {
+    watch_dirs = arena_grow(&config_arena, watch_dirs, nwatch_dir, sizeof(WatchDir));
+    WatchDir *d = &watch_dirs[nwatch_dir];
+    memset(d, 0, sizeof *d);
+    d->dir = dir ? arena_strdup(&config_arena, dir) : NULL;
+    d->vars = dir ? flatten_scope() : NULL;
+    d->parent = watch_cur;
+    d->active = 1;
+    watch_counts(d->lo);
+    return watch_cur = nwatch_dir++;
+}
+static void watch_leave(int d) {
+    watch_counts(watch_dirs[d].hi);
+    watch_dirs[d].active = 0;
+    watch_dirs[d].scope = NULL;
+    watch_cur = watch_dirs[d].parent;
+}
+
+// A target is compiled with the CMAKE_C_FLAGS its directory ends with
+static void finish_directory(int first_target) {
+    const char *flags = getvar("CMAKE_C_FLAGS");
+    for (int i = first_target; i < ntarget; i++)
+        if (!targets[i].dir_flags) targets[i].dir_flags = flags;
+}
+// Runs dir/CMakeLists.txt in a scope of its own. Paths in it are still taken
+// from the top directory, where the build runs.
+static void configure_directory(const char *dir) {
+    StrBuf path = {0}, abs = {0};
+    sb_puts(&path, dir);
+    sb_puts(&path, "/CMakeLists.txt");
+    if (dir[0] != '/' && !(dir[0] && dir[1] == ':')) {
+        sb_puts(&abs, getvar("CMAKE_SOURCE_DIR"));
+        sb_putc(&abs, '/');
+    }
+    sb_puts(&abs, dir);
+
+    Scope scope;
+    int wd = watching ? watch_enter(dir) : -1;
+    push_scope(&scope);
+    if (wd >= 0) watch_dirs[wd].scope = cur_scope;
+    setvar("CMAKE_CURRENT_SOURCE_DIR", sb_str(&abs));
+    setvar("CMAKE_CURRENT_LIST_DIR", sb_str(&abs));
+    int first_target = ntarget, saved_loops = loop_depth;
+    loop_depth = 0;
+    if (!run_script_file(sb_str(&path)))
+        DPRINTF("add_subdirectory failed: %s not found\n", sb_str(&path));
+    loop_depth = saved_loops;
+    finish_directory(first_target);
+    pop_scope();
+    if (wd >= 0) watch_leave(wd);
+}
+
+// ---- Parallel Subdirectories ----
+// A run of sibling add_subdirectory() calls is split into contiguous chunks,
+// each configured on a thread of its own into tables of its own. The scopes
+// and tables of the directory that started the batch do not change meanwhile
+// and are read through. Chunks are merged in order, so the result is the one
+// a serial run gives: a chunk that may have seen something a serial run would
+// not (a name an earlier chunk defined, a change to the shared state) is
+// configured again serially, and so is every chunk after it.
+#ifndef _WIN32
+typedef struct ConfigView {
+    const struct ConfigView *up;
+    Target *targets;
+    const NameIndex *target_index;
+    int ntarget;                // entries after these are not visible
+    const Function *functions;
+    const NameIndex *function_index;
+    int nfunction;
+} ConfigView;
+
+struct SubdirJob {
+    const Script *script;
+    int from, to;               // the chunk's add_subdirectory() commands
+    const char *dir;            // without a script: the directory --watch configures again
+    Scope *scope;               // of the directory that started the batch
+    ConfigView view;            // its tables
+    NameIndex outer;            // names looked up in view, found or not
+    int serial;                 // needs something only a serial run may do
+
+    // What the thread configured
+    Arena arena;
+    size_t scratch_nalloc, scratch_nbyte;
+    char *out;                  // its messages
+    size_t nout;
+    int error;
+    Target *targets;
+    int ntarget;
+    Function *functions;
+    int nfunction;
+    char **incs;
+    int ninc;
+    char **scripts;
+    int nscript;
+    GlobRecord *globs;
+    int nglob;
+    SourceProps *sources;
+    int nsource;
+    WatchDir *dirs;
+    int ndir;
+};
+
+static pthread_mutex_t subdir_lock = PTHREAD_MUTEX_INITIALIZER;
+static int subdir_threads_free = 0;     // configure threads that may still start
+
+static void start_subdir_threads(int jobs) {
+    // Profiling times commands on one thread
+    subdir_threads_free = prof.enabled || watching ? 0 : jobs;
+    intern_locked = subdir_threads_free > 1;
+}
+static Target *outer_target(const char *name) {
+    if (!subdir_job) return NULL;
+    const char *k = intern_n(name, strlen(name));
+    name_index_put(&subdir_job->outer, k, 0);
+    for (const ConfigView *v = &subdir_job->view; v; v = v->up) {
+        int idx = name_index_get(v->target_index, k);
+        if (idx >= 0 && idx < v->ntarget) return &v->targets[idx];
+    }
+    return NULL;
+}
+static const Function *outer_function(const char *id) {
+    if (!subdir_job) return NULL;
+    name_index_put(&subdir_job->outer, id, 0);
+    for (const ConfigView *v = &subdir_job->view; v; v = v->up) {
+        int idx = name_index_get(v->function_index, id);
+        if (idx >= 0 && idx < v->nfunction) return &v->functions[idx];
+    }
+    return NULL;
+}
+// Stops the thread's chunk; it is configured again when the batch is merged
+static void run_serially(void) {
+    if (!subdir_job) return;
+    subdir_job->serial = 1;
+    configure_error = 1;
+}
+
+static void add_subdirectories(const Script *s, int from, int to) {
+    for (int n = from; n < to && !configure_error; n++) {
+        ArenaMark mark = arena_mark(&scratch_arena);
+        char **argv;
+        int argc = expand_command(&s->cmds[n], &argv);
+        cmd_add_subdirectory(argc, argv);
+        arena_release(&scratch_arena, mark);
+    }
+}
+static void *subdir_thread(void *arg) {
+    SubdirJob *j = arg;
+    subdir_job = j;
+    cur_scope = j->scope;
+    config_arena = j->arena;    // empty unless handed over
+    message_buf = open_memstream(&j->out, &j->nout);
+    if (j->script) add_subdirectories(j->script, j->from, j->to);
+    else configure_directory(j->dir);
+    if (message_buf) fclose(message_buf);
+
+    j->error = configure_error;
+    j->arena = config_arena;
+    j->scratch_nalloc = scratch_arena.nalloc;
+    j->scratch_nbyte = scratch_arena.nbyte;
+    arena_free(&scratch_arena);
+    j->targets = targets;
+    j->ntarget = ntarget;
+    j->functions = functions;
+    j->nfunction = nfunction;
+    j->incs = global_incs;
+    j->ninc = nglobal_incs;
+    j->scripts = script_files;
+    j->nscript = nscript_files;
+    j->globs = glob_records;
+    j->nglob = nglob_record;
+    j->sources = source_props;
+    j->nsource = nsource_props;
+    j->dirs = watch_dirs;
+    j->ndir = nwatch_dir;
+    NameIndex *indexes[] = { &target_index, &function_index, &source_index };
+    for (int i = 0; i < 3; i++) {
+        free(indexes[i]->keys);
+        free(indexes[i]->vals);
+    }
+    return NULL;
+}
+// Whether the chunk looked up a name that an earlier chunk defined
+static int outer_conflict(const SubdirJob *j, const NameIndex *defined) {
+    for (size_t i = 0; i < j->outer.cap; i++)
+        if (j->outer.keys[i] && name_index_get(defined, j->outer.keys[i]) >= 0) return 1;
+    return 0;
+}
+// Appends what a chunk configured to this thread's tables, as if it had run here
+static void merge_subdir_job(SubdirJob *j, NameIndex *defined) {
+    fwrite(j->out, 1, j->nout, message_out());
+    for (int i = 0; i < j->ntarget; i++) {
+        Target *t = new_target(j->targets[i].name, j->targets[i].type);
+        *t = j->targets[i];
+        name_index_put(defined, t->name, 0);
+    }
+    for (int i = 0; i < j->nfunction; i++) {
+        *function_slot(j->functions[i].id) = j->functions[i];
+        name_index_put(defined, j->functions[i].id, 0);
+    }
+    for (int i = 0; i < j->ninc; i++) add_string(&global_incs, &nglobal_incs, j->incs[i]);
+    for (int i = 0; i < j->nscript; i++) add_string(&script_files, &nscript_files, j->scripts[i]);
+    for (int i = 0; i < j->nglob; i++) {
+        glob_records = arena_grow(&config_arena, glob_records, nglob_record, sizeof(GlobRecord));
+        glob_records[nglob_record++] = j->globs[i];
+    }
+    for (int i = 0; i < j->nsource; i++)
+        for (int k = 0; k + 1 < j->sources[i].nprop; k += 2)
+            set_source_prop(j->sources[i].path, j->sources[i].props[k], j->sources[i].props[k + 1]);
+    if (j->error) configure_error = 1;
+    // A batch this thread is part of checks the names against its own chunks
+    for (size_t i = 0; subdir_job && i < j->outer.cap; i++)
+        if (j->outer.keys[i]) name_index_put(&subdir_job->outer, j->outer.keys[i], 0);
+}
+// Runs the add_subdirectory() calls from cmds[from] up to the next other
+// command on configure threads. 0 if fewer than two threads are free,
+// otherwise *last is set to the last command run.
+static int run_subdirectories(const Script *s, int from, int to, int *last) {
+    int end = from;
+    while (end < to && s->cmds[end].op == s->cmds[from].op) end++;
+    // A configure thread waits for the batch it starts, its slot is free meanwhile
+    int own = subdir_job != NULL;
+    pthread_mutex_lock(&subdir_lock);
+    int nthread = subdir_threads_free + own;
+    if (nthread > end - from) nthread = end - from;
+    if (nthread >= 2) subdir_threads_free -= nthread - own;
+    pthread_mutex_unlock(&subdir_lock);
+    if (nthread < 2) return 0;
+
+    // Scopes the threads read must not change; lists get their string form
+    // now so that reading one never writes
+    Scope *shared = cur_scope;
+    for (; shared && !shared->shared; shared = shared->parent) {
+        shared->shared = 1;
+        for (int i = 0; i < shared->nvars; i++)
+            if (shared->vars[i].val.items) value_str(&shared->vars[i].val);
+    }
+
+    SubdirJob *jobs = calloc(nthread, sizeof(SubdirJob));
+    pthread_t *threads = malloc(nthread * sizeof(pthread_t));
+    char *started = malloc(nthread);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 8 << 20);     // what the main thread usually gets
+    for (int i = 0; i < nthread; i++) {
+        SubdirJob *j = &jobs[i];
+        j->script = s;
+        j->from = from + (end - from) * i / nthread;
+        j->to = from + (end - from) * (i + 1) / nthread;
+        j->scope = cur_scope;
+        j->view.up = subdir_job ? &subdir_job->view : NULL;
+        j->view.targets = targets;
+        j->view.target_index = &target_index;
+        j->view.ntarget = ntarget;
+        j->view.functions = functions;
+        j->view.function_index = &function_index;
+        j->view.nfunction = nfunction;
+        // A thread that cannot start leaves its chunk to the serial pass
+        started[i] = pthread_create(&threads[i], &attr, subdir_thread, j) == 0;
+        if (!started[i]) j->serial = 1;
+    }
+    pthread_attr_destroy(&attr);
+    for (int i = 0; i < nthread; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+
+    for (Scope *sc = cur_scope; sc != shared; sc = sc->parent) sc->shared = 0;
+    pthread_mutex_lock(&subdir_lock);
+    subdir_threads_free += nthread - own;
+    pthread_mutex_unlock(&subdir_lock);
+
+    NameIndex defined = {0};
+    int serial = 0;
+    for (int i = 0; i < nthread; i++) {
+        SubdirJob *j = &jobs[i];
+        arena_adopt(&config_arena, &j->arena);
+        scratch_arena.nalloc += j->scratch_nalloc;
+        scratch_arena.nbyte += j->scratch_nbyte;
+        if (!configure_error) {
+            // After a failed chunk nothing runs, as in a serial run
+            if (!serial) serial = j->serial || outer_conflict(j, &defined);
+            if (serial) {
+                DPRINTF("add_subdirectory: configuring %d directories serially\n", j->to - j->from);
+                add_subdirectories(s, j->from, j->to);
+            } else {
+                merge_subdir_job(j, &defined);
+            }
+        }
+        free(j->out);
+        free(j->targets);
+        free(j->outer.keys);
+        free(j->outer.vals);
+    }
+    free(defined.keys);
+    free(defined.vals);
+    free(jobs);
+    free(threads);
+    free(started);
+    *last = end - 1;
+    return 1;
+}
+#else
+static Target *outer_target(const char *name) { (void)name; return NULL; }
+static const Function *outer_function(const char *id) { (void)id; return NULL; }
+static void run_serially(void) {}
+static int run_subdirectories(const Script *s, int from, int to, int *last) {
+    (void)s; (void)from; (void)to; (void)last;
+    return 0;
+}
+#endif
+
+static int configure_project(int jobs) {
+    char cwd[256];
+    if (getcwd(cwd, sizeof(cwd))) {
+        setvar("CMAKE_CURRENT_LIST_DIR", cwd);
+        setvar("CMAKE_CURRENT_SOURCE_DIR", cwd);
+        setvar("CMAKE_SOURCE_DIR", cwd);
+    }
+#ifndef _WIN32
+    start_subdir_threads(jobs);
+#else
+    (void)jobs;
+#endif
+
+    int wd = watching ? watch_enter(NULL) : -1;
+    if (wd >= 0) watch_dirs[wd].scope = cur_scope;
+    int found = run_script_file("CMakeLists.txt");
+    if (found) finish_directory(0);
+    if (wd >= 0) watch_leave(wd);
+    if (!found) {
+        if (!configure_error) puts("CMakeLists.txt not found.");
+        return 1;
+    }
+    return configure_error;
+}
+
+// ---- Configure Cache ----
+// A binary snapshot of the variable and target tables, plus a content hash of
+// every script that was read. When no script changed (and no globbed directory
+// gained or lost entries) the next run loads it instead of parsing again.
+#define CACHE_FILE "MiniCMakeCache.bin"
+#define CACHE_MAGIC 0x434d434dU
+#define CACHE_VERSION 7
+
+// -D<var>=<value> from the command line. They are part of the cache key and
+// stay in effect for later runs, including regeneration by make or ninja,
+// until -D is given again or --fresh drops them.
+static char **cmdline_defs;
+static int ncmdline_def;
+
+// FNV-1a of a file's contents; 0 if it cannot be read
+static unsigned long long hash_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    unsigned long long h = HASH_SEED;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof chunk, f)) > 0) h = hash_bytes(chunk, n, h);
+    fclose(f);
+    return h;
+}
+
+static void cache_put_u64(FILE *f, unsigned long long v) { fwrite(&v, sizeof v, 1, f); }
+static void cache_put_str(FILE *f, const char *s) {
+    unsigned long long len = strlen(s);
+    cache_put_u64(f, len);
+    fwrite(s, 1, len, f);
+}
+static void cache_put_list(FILE *f, char **list, int n) {
+    cache_put_u64(f, n);
+    for (int i = 0; i < n; i++) cache_put_str(f, list[i]);
+}
+static int cache_get_u64(FILE *f, unsigned long long *v) { return fread(v, sizeof *v, 1, f) == 1; }
+static char *cache_get_str(FILE *f, Arena *a) {
+    unsigned long long len;
+    if (!cache_get_u64(f, &len) || len > (1ULL << 31)) return NULL;
+    char *s = arena_alloc(a, len + 1);
+    if (fread(s, 1, len, f) != len) return NULL;
+    s[len] = 0;
+    return s;
+}
+static int cache_get_list(FILE *f, char ***list, int *n) {
+    unsigned long long count;
+    if (!cache_get_u64(f, &count)) return 0;
+    for (unsigned long long i = 0; i < count; i++) {
+        char *s = cache_get_str(f, &config_arena);
+        if (!s) return 0;
+        *list = arena_grow(&config_arena, *list, *n, sizeof(char *));
+        (*list)[(*n)++] = s;
+    }
+    return 1;
+}
+
+static void cache_put_glob(FILE *f, const GlobRecord *rec) {
+    cache_put_str(f, rec->pattern);
+    cache_put_u64(f, rec->flags);
+    cache_put_u64(f, rec->ndir);
+    for (int i = 0; i < rec->ndir; i++) {
+        cache_put_str(f, rec->dirs[i]);
+        cache_put_u64(f, (unsigned long long)rec->dir_mtimes[i]);
+    }
+    cache_put_list(f, rec->matches, rec->nmatch);
+}
+// Reads a glob record whose strings and arrays live in `a`
+static int cache_get_glob(FILE *f, Arena *a, GlobRecord *rec) {
+    unsigned long long flags, n, v;
+    memset(rec, 0, sizeof *rec);
+    rec->pattern = cache_get_str(f, a);
+    if (!rec->pattern || !cache_get_u64(f, &flags) || !cache_get_u64(f, &n)) return 0;
+    rec->flags = (int)flags;
+    for (unsigned long long i = 0; i < n; i++) {
+        char *dir = cache_get_str(f, a);
+        if (!dir || !cache_get_u64(f, &v)) return 0;
+        rec->dirs = arena_grow(a, rec->dirs, rec->ndir, sizeof(char *));
+        rec->dir_mtimes = arena_grow(a, rec->dir_mtimes, rec->ndir, sizeof(long long));
+        rec->dirs[rec->ndir] = dir;
+        rec->dir_mtimes[rec->ndir++] = (long long)v;
+    }
+    if (!cache_get_u64(f, &n)) return 0;
+    for (unsigned long long i = 0; i < n; i++) {
+        char *m = cache_get_str(f, a);
+        if (!m) return 0;
+        rec->matches = arena_grow(a, rec->matches, rec->nmatch, sizeof(char *));
+        rec->matches[rec->nmatch++] = m;
+    }
+    return 1;
+}
+
+static void save_cache(void) {
+    FILE *f = fopen(CACHE_FILE ".tmp", "wb");
+    if (!f) return;
+    cache_put_u64(f, CACHE_MAGIC);
+    cache_put_u64(f, CACHE_VERSION);
+    cache_put_list(f, cmdline_defs, ncmdline_def);
+
+    cache_put_u64(f, nscript_files);
+    for (int i = 0; i < nscript_files; i++) {
+        // --watch hashed each script as it read it
+        unsigned long long hash = watch_file_hash(script_files[i]);
+        cache_put_str(f, script_files[i]);
+        cache_put_u64(f, hash ? hash : hash_file(script_files[i]));
+    }
+    cache_put_u64(f, nglob_record);
+    for (int i = 0; i < nglob_record; i++) cache_put_glob(f, &glob_records[i]);
+
+    // Subdirectory scopes are gone by now, only the top directory's is left
+    int ndefined = 0;
+    for (int i = 0; i < top_scope.nvars; i++) ndefined += value_defined(&top_scope.vars[i].val);
+    cache_put_u64(f, ndefined);
+    for (int i = 0; i < top_scope.nvars; i++) {
+        Var *v = &top_scope.vars[i];
+        if (!value_defined(&v->val)) continue;
+        cache_put_str(f, v->key);
+        cache_put_str(f, value_str(&v->val));
+    }
+    cache_put_list(f, global_incs, nglobal_incs);
+    cache_put_u64(f, nsource_props);
+    for (int i = 0; i < nsource_props; i++) {
+        cache_put_str(f, source_props[i].path);
+        cache_put_list(f, source_props[i].props, source_props[i].nprop);
+    }
 
-    if (sscanf(cleaned, " %127[^ )] %4095[^)]", tname, libs) != 2) {
-        DPRINTF("target_link_libraries: parse failed: '%s'\n", cleaned);
-        return;
+    cache_put_u64(f, ntarget);
+    for (int i = 0; i < ntarget; i++) {
+        Target *t = &targets[i];
+        cache_put_str(f, t->name);
+        cache_put_str(f, t->type);
+        cache_put_list(f, t->srcs, t->nsrc);
+        cache_put_list(f, t->props, t->nprop);
+        cache_put_list(f, t->defs, t->ndef);
+        cache_put_list(f, t->incs, t->ninc);
+        cache_put_list(f, t->libs, t->nlib);
+        cache_put_list(f, t->iface_defs, t->niface_def);
+        cache_put_list(f, t->iface_incs, t->niface_inc);
+        cache_put_list(f, t->iface_libs, t->niface_lib);
+        cache_put_list(f, t->pchs, t->npch);
+        cache_put_list(f, t->iface_pchs, t->niface_pch);
+        cache_put_str(f, t->pch_reuse ? t->pch_reuse : "");
+        cache_put_str(f, t->dir_flags ? t->dir_flags : "");
     }
 
-    DPRINTF("PARSED tname='%s'\n", tname);
-    DPRINTF("PARSED libs='%s'\n", libs);
+    int ok = !ferror(f);
+    fclose(f);
+    if (ok) rename(CACHE_FILE ".tmp", CACHE_FILE);
+    else remove(CACHE_FILE ".tmp");
+}
 
-    trim_token(tname);
+// Checks the configure inputs recorded in an open cache: script hashes and
+// glob results. At build time only CONFIGURE_DEPENDS globs are checked, the
+// generated build already depends on the scripts themselves.
+static int cache_inputs_unchanged(FILE *f, int build_time) {
+    unsigned long long magic, version, count, v;
+    int ok = cache_get_u64(f, &magic) && magic == CACHE_MAGIC &&
+             cache_get_u64(f, &version) && version == CACHE_VERSION;
+
+    if (ok) ok = cache_get_u64(f, &count) && (build_time || count == (unsigned long long)ncmdline_def);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *def = cache_get_str(f, &scratch_arena);
+        ok = def && (build_time || strcmp(def, cmdline_defs[i]) == 0);
+    }
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *path = cache_get_str(f, &scratch_arena);
+        ok = path && cache_get_u64(f, &v) && (build_time || hash_file(path) == v);
+    }
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        GlobRecord rec;
+        ok = cache_get_glob(f, &scratch_arena, &rec);
+        if (ok && (!build_time || (rec.flags & GLOB_CONFIGURE_DEPENDS))) ok = glob_unchanged(&rec);
+    }
+    arena_reset(&scratch_arena);
+    return ok;
+}
+// --verify-globs, run by the generated build before anything else: touches
+// the glob stamp if a CONFIGURE_DEPENDS glob no longer matches the same files
+static int verify_globs(void) {
+    FILE *f = fopen(CACHE_FILE, "rb");
+    int ok = f && cache_inputs_unchanged(f, 1);
+    if (f) fclose(f);
+    if (ok) return 0;
+
+    puts("-- GLOB mismatch!");
+    make_parent_dirs(GLOB_STAMP);
+    FILE *s = fopen(GLOB_STAMP, "w");
+    if (!s) return 1;
+    fputs("glob results changed\n", s);
+    fclose(s);
+    return 0;
+}
+// After (re)generating, the stamp must not be newer than the build file,
+// even when write_if_changed() left an old one in place
+static void reset_glob_stamp(const char *build_file) {
+    if (!has_configure_depends()) return;
+    struct stat st;
+    if (stat(build_file, &st) != 0) return;
+    make_parent_dirs(GLOB_STAMP);
+    FILE *s = fopen(GLOB_STAMP, "w");
+    if (!s) return;
+    fclose(s);
+    struct utimbuf times = { st.st_mtime, st.st_mtime };
+    utime(GLOB_STAMP, &times);
+}
 
-    Target *dst = NULL;
-    for (int i = 0; i < ntarget; i++) {
-        if (strcmp(targets[i].name, tname) == 0) {
-            dst = &targets[i];
-            break;
+// Picks up the -D definitions of an earlier run when none are given
+static void load_cached_defs(void) {
+    FILE *f = fopen(CACHE_FILE, "rb");
+    if (!f) return;
+    unsigned long long magic, version;
+    if (cache_get_u64(f, &magic) && magic == CACHE_MAGIC &&
+        cache_get_u64(f, &version) && version == CACHE_VERSION &&
+        !cache_get_list(f, &cmdline_defs, &ncmdline_def)) {
+        cmdline_defs = NULL;
+        ncmdline_def = 0;
+    }
+    fclose(f);
+}
+
+// Returns 1 and fills the tables if the cache exists and is still valid
+static int load_cache(void) {
+    FILE *f = fopen(CACHE_FILE, "rb");
+    if (!f) return 0;
+    unsigned long long magic, version, count, v;
+
+    // Check every input before touching any table
+    if (!cache_inputs_unchanged(f, 0)) {
+        fclose(f);
+        DPRINTF("configure cache is stale, parsing again\n");
+        return 0;
+    }
+    int ok = 1;
+
+    // Inputs are unchanged: read the cache a second time to load the tables
+    rewind(f);
+    cache_get_u64(f, &magic);
+    cache_get_u64(f, &version);
+    cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) ok = cache_get_str(f, &scratch_arena) != NULL;
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *path = cache_get_str(f, &config_arena);
+        ok = path && cache_get_u64(f, &v);
+        if (ok) add_string(&script_files, &nscript_files, path);
+    }
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        glob_records = arena_grow(&config_arena, glob_records, nglob_record, sizeof(GlobRecord));
+        ok = cache_get_glob(f, &config_arena, &glob_records[nglob_record]);
+        if (ok) nglob_record++;
+    }
+
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *key = cache_get_str(f, &config_arena);
+        char *val = key ? cache_get_str(f, &config_arena) : NULL;
+        ok = key && val;
+        if (ok) setvar(key, val);
+    }
+    if (ok) ok = cache_get_list(f, &global_incs, &nglobal_incs);
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *path = cache_get_str(f, &scratch_arena);
+        ok = path != NULL;
+        if (ok) {
+            SourceProps *s = find_source_props(path, 1);
+            ok = cache_get_list(f, &s->props, &s->nprop);
         }
     }
-    if (!dst) return;
 
-    char *saveptr = NULL;
-    char *lib = strtok_r(libs, " ", &saveptr);
+    if (ok) ok = cache_get_u64(f, &count);
+    for (unsigned long long i = 0; ok && i < count; i++) {
+        char *name = cache_get_str(f, &scratch_arena);
+        char *type = name ? cache_get_str(f, &scratch_arena) : NULL;
+        ok = name && type && *name;
+        if (ok) {
+            Target *t = new_target(name, type);
+            ok = cache_get_list(f, &t->srcs, &t->nsrc) &&
+                 cache_get_list(f, &t->props, &t->nprop) &&
+                 cache_get_list(f, &t->defs, &t->ndef) &&
+                 cache_get_list(f, &t->incs, &t->ninc) &&
+                 cache_get_list(f, &t->libs, &t->nlib) &&
+                 cache_get_list(f, &t->iface_defs, &t->niface_def) &&
+                 cache_get_list(f, &t->iface_incs, &t->niface_inc) &&
+                 cache_get_list(f, &t->iface_libs, &t->niface_lib) &&
+                 cache_get_list(f, &t->pchs, &t->npch) &&
+                 cache_get_list(f, &t->iface_pchs, &t->niface_pch);
+            char *reuse = ok ? cache_get_str(f, &scratch_arena) : NULL;
+            ok = reuse != NULL;
+            if (ok && *reuse) t->pch_reuse = intern_n(reuse, strlen(reuse));
+            if (ok) ok = (t->dir_flags = cache_get_str(f, &config_arena)) != NULL;
+        }
+    }
+    fclose(f);
 
-    while (lib) {
-        trim_token(lib);
+    if (!ok) {
+        // A truncated cache is treated like a missing one
+        puts("Configure cache is corrupt, ignoring it.");
+        reset_vars();
+        reset_targets();
+        nglobal_incs = nscript_files = nglob_record = nsource_props = 0;
+        name_index_clear(&source_index);
+        return 0;
+    }
+    return 1;
+}
 
-        DPRINTF("Processing lib token='%s'\n", lib);
+// What a configure starts with, before CMakeLists.txt runs
+static void set_default_vars(void) {
+    setvar("CMAKE_C_FLAGS", "");
+    setvar("CMAKE_C_STANDARD", "99");
+    setvar("CMAKE_C_COMPILER", "gcc");
+    setvar("CMAKE_C_FLAGS_DEBUG", "-g");
+    setvar("CMAKE_C_FLAGS_RELEASE", "-O3 -DNDEBUG");
+    setvar("CMAKE_C_FLAGS_RELWITHDEBINFO", "-O2 -g -DNDEBUG");
+    setvar("CMAKE_C_FLAGS_MINSIZEREL", "-Os -DNDEBUG");
+    for (int i = 0; i < ncmdline_def; i++) {
+        char *eq = strchr(cmdline_defs[i], '=');
+        StrBuf name = {0};
+        sb_putn(&name, cmdline_defs[i], eq - cmdline_defs[i]);
+        setvar(sb_str(&name), eq + 1);
+    }
+    #ifdef _WIN32
+        setvar("WIN32", "ON");
+        #ifdef _MSC_VER
+            setvar("MSVC", "ON");
+        #endif
+    #else
+        setvar("UNIX", "ON");
+        #ifdef __APPLE__
+            setvar("APPLE", "ON");
+        #endif
+    #endif
+}
+// Writes the build file, leaving it alone if nothing in it changed
+static int write_build_file(const Generator *gen) {
+    if (!write_if_changed(gen->file, gen->write)) {
+        printf("Could not write %s.\n", gen->file);
+        return 0;
+    }
+    reset_glob_stamp(gen->file);
+    return 1;
+}
 
-        add_string(&dst->libs, &dst->nlib, lib);
+#ifndef _WIN32
+// ---- Object Cache ----
+// mini_cmake --cache-compile <dir> <max-size> -- <compile command>
+// Stands in front of the compiler. Objects are stored as <dir>/<xx>/<key>.o,
+// keyed by the compiler binary, the flags and the preprocessed source, so
+// identical translation units are compiled once across branches and trees
+// that share <dir>. Each of the 256 <xx> buckets is kept under max-size/256
+// by evicting the least recently used objects.
+#define OBJECT_CACHE_VERSION "mini-cmake-object-cache-1"
+
+static unsigned long long parse_size(const char *s) {
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+        case 'G': n <<= 10; // fall through
+        case 'M': n <<= 10; // fall through
+        case 'K': n <<= 10;
+    }
+    return n;
+}
+static int run_argv(char **argv) {
+    pid_t pid;
+    extern char **environ;
+    fflush(stdout);
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) return -1;
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+// Copies through a temporary and a rename, so readers never see half a file
+static int copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    if (!in) return 0;
+    char *tmp = str_printf("%s.tmp.%ld", to, (long)getpid());
+    FILE *out = fopen(tmp, "wb");
+    int ok = out != NULL;
+    char chunk[65536];
+    size_t n;
+    while (ok && (n = fread(chunk, 1, sizeof chunk, in)) > 0) ok = fwrite(chunk, 1, n, out) == n;
+    fclose(in);
+    if (out && fclose(out) != 0) ok = 0;
+    if (ok) ok = rename(tmp, to) == 0;
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok;
+}
+// Identifies a program by its resolved path, size and mtime, like ccache's
+// default compiler check, without running it
+static unsigned long long hash_program(const char *name, unsigned long long h) {
+    char path[4096];
+    struct stat st;
+    int found = 0;
+    if (strchr(name, '/')) {
+        snprintf(path, sizeof path, "%s", name);
+        found = stat(path, &st) == 0;
+    } else {
+        const char *dirs = getenv("PATH");
+        for (const char *p = dirs ? dirs : ""; *p && !found; ) {
+            const char *colon = strchr(p, ':');
+            size_t len = colon ? (size_t)(colon - p) : strlen(p);
+            snprintf(path, sizeof path, "%.*s/%s", (int)len, p, name);
+            found = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+            p += len + (colon != NULL);
+        }
+    }
+    h = hash_bytes(name, strlen(name) + 1, h);
+    if (!found) return h;
+    long long mtime = stat_mtime(&st);
+    h = hash_bytes(&st.st_size, sizeof st.st_size, h);
+    return hash_bytes(&mtime, sizeof mtime, h);
+}
+static unsigned long long hash_file_into(const char *path, unsigned long long h) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return h;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof chunk, f)) > 0) h = hash_bytes(chunk, n, h);
+    fclose(f);
+    return h;
+}
 
-        for (int i = 0; i < ntarget; i++) {
-            if (strcmp(targets[i].name, lib) == 0) {
-                Target *src = &targets[i];
+typedef struct {
+    char *path;
+    long long mtime;
+    long long size;
+} CachedObject;
+static int cmp_cached_object(const void *a, const void *b) {
+    long long ma = ((const CachedObject *)a)->mtime, mb = ((const CachedObject *)b)->mtime;
+    return ma < mb ? -1 : ma > mb;
+}
+// Evicts least recently used objects until the bucket is under 90% of limit
+static void trim_bucket(const char *bucket, unsigned long long limit) {
+    DIR *dp = opendir(bucket);
+    if (!dp) return;
+    CachedObject *objs = NULL;
+    int nobj = 0, cap = 0;
+    unsigned long long total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dp))) {
+        if (!has_suffix(entry->d_name, ".o")) continue;
+        char *path = str_printf("%s/%s", bucket, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) { free(path); continue; }
+        if (nobj == cap) {
+            cap = cap ? cap * 2 : 64;
+            objs = realloc(objs, cap * sizeof(CachedObject));
+        }
+        objs[nobj].path = path;
+        objs[nobj].mtime = stat_mtime(&st);
+        objs[nobj].size = st.st_size;
+        nobj++;
+        total += st.st_size;
+    }
+    closedir(dp);
 
-                DPRINTF("Propagating from target '%s' to '%s'\n", src->name, dst->name);
-                for (int j = 0; j < src->ninc; j++) add_string(&dst->incs, &dst->ninc, src->incs[j]);
-                for (int j = 0; j < src->ndef; j++) add_string(&dst->defs, &dst->ndef, src->defs[j]);
-                for (int j = 0; j < src->nlib; j++) add_string(&dst->libs, &dst->nlib, src->libs[j]);
-            }
+    if (total > limit) {
+        qsort(objs, nobj, sizeof(CachedObject), cmp_cached_object);
+        // The newest object is the one just stored; always keep it
+        for (int i = 0; i < nobj - 1 && total > limit / 10 * 9; i++) {
+            if (unlink(objs[i].path) == 0) total -= objs[i].size;
         }
+    }
+    for (int i = 0; i < nobj; i++) free(objs[i].path);
+    free(objs);
+}
 
-        lib = strtok_r(NULL, " ", &saveptr);
+static int cache_compile(int argc, char **argv) {
+    if (argc < 4 || strcmp(argv[2], "--") != 0) {
+        puts("usage: mini_cmake --cache-compile <dir> <max-size> -- <compiler> <args>...");
+        return 1;
+    }
+    const char *dir = argv[0];
+    unsigned long long limit = parse_size(argv[1]);
+    char **cmd = argv + 3;
+    int ncmd = argc - 3;
+
+    // Only plain compiles to an object are cached; anything else runs as is
+    const char *obj = NULL;
+    int compile = 0, cacheable = 1, has_mt = 0, has_mf = 0, deps = 0;
+    for (int i = 0; i < ncmd; i++) {
+        if (strcmp(cmd[i], "-c") == 0) compile = 1;
+        else if (strcmp(cmd[i], "-o") == 0 && i + 1 < ncmd) obj = cmd[i + 1];
+        else if (strcmp(cmd[i], "-x") == 0 || strcmp(cmd[i], "-") == 0) cacheable = 0;
+        else if (strcmp(cmd[i], "-MT") == 0 || strcmp(cmd[i], "-MQ") == 0) has_mt = 1;
+        else if (strcmp(cmd[i], "-MF") == 0) has_mf = 1;
+        else if (strcmp(cmd[i], "-MMD") == 0 || strcmp(cmd[i], "-MD") == 0) deps = 1;
+    }
+    if (!compile || !obj || !cacheable) return run_argv(cmd);
+
+    // Key: compiler identity, flags that affect the object, preprocessed source
+    unsigned long long h1 = hash_bytes(OBJECT_CACHE_VERSION, strlen(OBJECT_CACHE_VERSION), HASH_SEED);
+    unsigned long long h2 = HASH_SEED ^ 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < ncmd && cmd[i][0] != '-'; i++) h1 = hash_program(cmd[i], h1);
+    for (int i = 0; i < ncmd; i++) {
+        if ((strcmp(cmd[i], "-o") == 0 || strcmp(cmd[i], "-MF") == 0 || strcmp(cmd[i], "-MT") == 0 ||
+             strcmp(cmd[i], "-MQ") == 0) && i + 1 < ncmd) {
+            i++;
+            continue;
+        }
+        if (strcmp(cmd[i], "-MMD") == 0 || strcmp(cmd[i], "-MD") == 0 || strcmp(cmd[i], "-MP") == 0) continue;
+        h1 = hash_bytes(cmd[i], strlen(cmd[i]) + 1, h1);
+        if (cmd[i][0] == '@') h1 = hash_file_into(cmd[i] + 1, h1);
     }
 
-    DPRINTF("Final libs for target '%s':\n", dst->name);
-    for (int j = 0; j < dst->nlib; j++)
-        DPRINTF("  lib[%d] = '%s'\n", j, dst->libs[j]);
+    // Preprocess into a temporary; this also writes the depfile for the object
+    char *pre = str_printf("%s.mini-cmake.i", obj);
+    char **pp = calloc(ncmd + 5, sizeof(char *));
+    int npp = 0;
+    for (int i = 0; i < ncmd; i++) {
+        if (strcmp(cmd[i], "-c") == 0) { pp[npp++] = "-E"; continue; }
+        pp[npp++] = cmd[i];
+        if (strcmp(cmd[i], "-o") == 0 && i + 1 < ncmd) { pp[npp++] = pre; i++; }
+    }
+    if (deps && !has_mt) {
+        pp[npp++] = "-MT";
+        pp[npp++] = (char *)obj;
+    }
+    // Without -MF gcc would name the depfile after the temporary; point it
+    // at <obj minus extension>.d, where a plain compile puts it
+    char *depfile = NULL;
+    if (deps && !has_mf) {
+        const char *slash = strrchr(obj, '/'), *dot = strrchr(obj, '.');
+        int stem = dot && (!slash || dot > slash) ? (int)(dot - obj) : (int)strlen(obj);
+        depfile = str_printf("%.*s.d", stem, obj);
+        pp[npp++] = "-MF";
+        pp[npp++] = depfile;
+    }
+    int pp_rc = run_argv(pp);
+    free(pp);
+    free(depfile);
+    char *stray = str_printf("%s.mini-cmake.d", obj);
+    unlink(stray);
+    free(stray);
+    if (pp_rc != 0) {
+        unlink(pre);
+        free(pre);
+        return run_argv(cmd);
+    }
+    h2 = hash_file_into(pre, h2 ^ h1);
+    h1 = hash_file_into(pre, h1);
+    unlink(pre);
+    free(pre);
+
+    char *bucket = str_printf("%s/%02llx", dir, h1 >> 56);
+    char *entry = str_printf("%s/%014llx%016llx.o", bucket, h1 & 0xffffffffffffffULL, h2);
+    if (copy_file(entry, obj)) {
+        utime(entry, NULL);   // refresh for LRU
+        DPRINTF("object cache hit: %s\n", obj);
+        free(bucket);
+        free(entry);
+        return 0;
+    }
 
-    DPRINTF("target_link_libraries: %s\n", tname);
+    int rc = run_argv(cmd);
+    if (rc == 0) {
+        make_parent_dirs(entry);
+        if (copy_file(obj, entry)) trim_bucket(bucket, limit / 256);
+    }
+    free(bucket);
+    free(entry);
+    return rc;
 }
-void cmd_project(const char *args) {
-    char name[128] = {0};
-    if (sscanf(args, "%127[^\n\r)]", name) == 1) {
-        trim_token(name);
-        setvar("PROJECT_NAME", name);
-        DPRINTF("project: set PROJECT_NAME = %s\n", name);
+#endif
+
+#ifndef _WIN32
+// ---- Build Trace ----
+// Step timings from the executor, or from TRACE_LOG for make and ninja
+// builds, attached to the action graph and written as Chrome trace events
+// (chrome://tracing, ui.perfetto.dev) plus a short text summary.
+#define TRACE_JSON OBJ_ROOT "/build_trace.json"
+
+// mini_cmake --trace-step <kind> <target> <output> -- <command>...
+// One line per step: start, end, status, kind, target, output, command
+static int trace_step(int argc, char **argv) {
+    if (argc < 5 || strcmp(argv[3], "--") != 0) {
+        puts("usage: mini_cmake --trace-step <kind> <target> <output> -- <command>...");
+        return 1;
+    }
+    long long start = now_us();
+    int rc = run_argv(argv + 4);
+    long long end = now_us();
+
+    char head[128];
+    snprintf(head, sizeof head, "%lld\t%lld\t%d\t", start, end, rc);
+    StrBuf line = {0};
+    sb_puts(&line, head);
+    for (int i = 0; i < 3; i++) {
+        sb_puts(&line, argv[i]);
+        sb_putc(&line, '\t');
+    }
+    for (int i = 4; i < argc; i++) {
+        if (i > 4) sb_putc(&line, ' ');
+        for (const char *p = argv[i]; *p; p++) sb_putc(&line, *p == '\t' || *p == '\n' ? ' ' : *p);
+    }
+    sb_putc(&line, '\n');
+    // A single O_APPEND write keeps lines from parallel steps whole
+    make_parent_dirs(TRACE_LOG);
+    int fd = open(TRACE_LOG, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd >= 0) {
+        if (write(fd, sb_str(&line), line.len) < 0) DPRINTF("could not write %s\n", TRACE_LOG);
+        close(fd);
     }
+    return rc < 0 ? 127 : rc;
 }
 
-void cmd_file_glob(const char *args) {
-    char var[128];
-    char pattern[512];
-    memset(pattern, 0, sizeof(pattern));
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+static long long action_duration(const Action *a) {
+    return a->end_us > a->start_us ? a->end_us - a->start_us : 0;
+}
+// Longest chain of measured steps from a to the end of the build
+static long long critical_path(Action *a) {
+    if (a->path_us) return a->path_us;
+    long long best = 0;
+    for (int i = 0; i < a->nuser; i++) {
+        long long p = critical_path(a->users[i]);
+        if (p > best) best = p;
+    }
+    return a->path_us = best + action_duration(a) + 1;
+}
+static int cmp_action_start(const void *a, const void *b) {
+    long long x = (*(Action *const *)a)->start_us, y = (*(Action *const *)b)->start_us;
+    return x < y ? -1 : x > y;
+}
+static int cmp_action_duration_desc(const void *a, const void *b) {
+    long long x = action_duration(*(Action *const *)a), y = action_duration(*(Action *const *)b);
+    return x > y ? -1 : x < y;
+}
 
-    if (sscanf(args, "%127s %511[^\n\r)]", var, pattern) < 2) {
-        DPRINTF("file(GLOB_RECURSE): parse fail '%s'\n", args);
+// Writes TRACE_JSON for the steps that ran and prints the top slowest
+// translation units and the critical path
+static void write_build_trace(int top) {
+    Action **ran = malloc((naction ? naction : 1) * sizeof(Action *));
+    int nran = 0;
+    for (int i = 0; i < naction; i++)
+        if (actions[i]->end_us) ran[nran++] = actions[i];
+    if (!nran) {
+        puts("-- Build trace: no steps ran.");
+        free(ran);
         return;
     }
+    qsort(ran, nran, sizeof(Action *), cmp_action_start);
+
+    // Steps get the first row free at their start, as a -j slot would
+    long long *row_end = malloc(nran * sizeof(long long));
+    int *row = malloc(nran * sizeof(int));
+    int nrow = 0;
+    long long t0 = ran[0]->start_us, t1 = t0;
+    for (int i = 0; i < nran; i++) {
+        int r = 0;
+        while (r < nrow && row_end[r] > ran[i]->start_us) r++;
+        if (r == nrow) nrow++;
+        row_end[r] = ran[i]->end_us;
+        row[i] = r;
+        if (ran[i]->end_us > t1) t1 = ran[i]->end_us;
+    }
 
-    trim_token(var);
-    trim_token(pattern);
+    FILE *out = fopen(TRACE_JSON, "w");
+    if (out) {
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+        for (int i = 0; i < nran; i++) {
+            Action *a = ran[i];
+            fputs(i ? ",\n{\"name\":" : "{\"name\":", out);
+            json_string(out, a->output);
+            fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d,\"args\":{\"target\":",
+                    action_kind_name(a->kind), a->start_us - t0, action_duration(a), row[i] + 1);
+            json_string(out, a->target->name);
+            fprintf(out, ",\"status\":%d,\"command\":", a->status);
+            json_string(out, a->command ? a->command : "");
+            fputs("}}", out);
+        }
+        fputs("\n]}\n", out);
+        fclose(out);
+    }
+    printf("-- Build trace: %s, %d steps in %.2f s on %d rows\n", TRACE_JSON, nran, (t1 - t0) / 1e6, nrow);
+
+    qsort(ran, nran, sizeof(Action *), cmp_action_duration_desc);
+    puts("-- Slowest translation units:");
+    for (int i = 0, shown = 0; i < nran && shown < top; i++) {
+        if (ran[i]->kind != ACT_COMPILE) continue;
+        printf("--   %8.2f s  %s (%s)\n", action_duration(ran[i]) / 1e6, ran[i]->output, ran[i]->target->name);
+        shown++;
+    }
 
-    if (strchr(pattern, ' ')) {
-        setvar(var, pattern);
-        return;
+    Action *a = NULL;
+    for (int i = 0; i < naction; i++)
+        if (!a || critical_path(actions[i]) > critical_path(a)) a = actions[i];
+    long long total = 0;
+    for (Action *p = a; p; ) {
+        total += action_duration(p);
+        Action *next = NULL;
+        for (int i = 0; i < p->nuser; i++)
+            if (!next || p->users[i]->path_us > next->path_us) next = p->users[i];
+        p = next;
     }
+    printf("-- Critical path: %.2f s\n", total / 1e6);
+    for (Action *p = a; p; ) {
+        if (action_duration(p)) printf("--   %8.2f s  %s %s\n", action_duration(p) / 1e6,
+                                       action_kind_name(p->kind), p->output);
+        Action *next = NULL;
+        for (int i = 0; i < p->nuser; i++)
+            if (!next || p->users[i]->path_us > next->path_us) next = p->users[i];
+        p = next;
+    }
+    free(row_end);
+    free(row);
+    free(ran);
+}
 
-    char expanded[512]; 
-    memset(expanded, 0, sizeof(expanded));
-    expand_vars(pattern, expanded, sizeof(expanded));
-    DPRINTF("file(GLOB_RECURSE): raw='%s' expanded='%s'\n", pattern, expanded);
+// --trace-report: attaches the steps logged by a make or ninja build to
+// the action graph, reports them and starts a new log
+static int trace_report(int top) {
+    FILE *f = fopen(TRACE_LOG, "r");
+    if (!f) {
+        printf("No build trace in %s. Set CMAKE_BUILD_TRACE and build first.\n", TRACE_LOG);
+        return 1;
+    }
+    build_action_graph();
+    NameIndex by_output = {0};
+    for (int i = 0; i < naction; i++)
+        name_index_put(&by_output, intern_n(actions[i]->output, strlen(actions[i]->output)), i);
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] == '\n') line[len - 1] = 0;
+        char *field[7];
+        int n = 0;
+        for (char *p = line; n < 7; n++) {
+            field[n] = p;
+            char *tab = n < 6 ? strchr(p, '\t') : NULL;
+            if (!tab) { n++; break; }
+            *tab = 0;
+            p = tab + 1;
+        }
+        if (n < 7) continue;
+        const char *out = intern_find(field[5], strlen(field[5]));
+        int idx = name_index_get(&by_output, out);
+        if (idx < 0) continue;
+        Action *a = actions[idx];
+        a->start_us = atoll(field[0]);
+        a->end_us = atoll(field[1]);
+        a->status = atoi(field[2]);
+        free(a->command);
+        a->command = strdup(field[6]);
+    }
+    free(line);
+    fclose(f);
+    free(by_output.keys);
+    free(by_output.vals);
 
-    char dir[512];
-    memset(dir, 0, sizeof(dir));
-    strncpy(dir, expanded, sizeof(dir) - 1);
+    write_build_trace(top);
+    free_action_graph();
+    f = fopen(TRACE_LOG, "w");
+    if (f) fclose(f);
+    return 0;
+}
+#endif
 
-    const char *ext = NULL;
-    char *star = strstr(dir, "/*");
-    if (star) {
-        ext = star + 1;
-        *star = '\0';
+// ---- Benchmark ----
+// mini_cmake --bench writes synthetic projects under BENCH_ROOT and times a
+// fresh configure + generate of each in a child process. Results go to
+// stdout as one JSON object per case; the child reports its arena use.
+#ifndef _WIN32
+#define BENCH_ROOT OBJ_ROOT "/bench"
 
-        if (ext[0] == '*') {
-            ext++;
-            if (ext[0] == '\0' || strcmp(ext, ".*") == 0) {
-                ext = NULL;
-            }
+static void bench_project(FILE *f) {
+    fputs("cmake_minimum_required(VERSION 3.10)\nproject(bench C)\n", f);
+}
+static FILE *bench_open(const char *dir) {
+    char *path = str_printf("%s/CMakeLists.txt", dir);
+    make_parent_dirs(path);
+    FILE *f = fopen(path, "w");
+    free(path);
+    return f;
+}
+// Libraries linked as a binary tree, every tenth with an executable on top
+static void bench_targets(FILE *f, const char *dir, int n) {
+    (void)dir;
+    bench_project(f);
+    fputs("add_compile_options(-Wall)\n", f);
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "add_library(lib%d STATIC src/lib%d.c src/lib%d_impl.c)\n", i, i, i);
+        fprintf(f, "target_include_directories(lib%d PUBLIC include/lib%d)\n", i, i);
+        fprintf(f, "target_compile_definitions(lib%d PRIVATE LIB%d_BUILD INTERFACE USE_LIB%d)\n", i, i, i);
+        if (i) fprintf(f, "target_link_libraries(lib%d PUBLIC lib%d)\n", i, (i - 1) / 2);
+        if (i % 10 == 9) {
+            fprintf(f, "add_executable(app%d src/app%d.c)\n", i, i);
+            fprintf(f, "target_link_libraries(app%d PRIVATE lib%d)\n", i, i);
         }
     }
-
-    if (!*dir) {
-        DPRINTF("file(GLOB_RECURSE): empty dir after expansion\n");
-        setvar(var, "");
-        return;
+}
+// A chain of add_subdirectory() calls n levels deep
+static void bench_deep(FILE *f, const char *dir, int n) {
+    bench_project(f);
+    char *sub = str_printf("%s/d", dir);
+    FILE *parent = f;
+    for (int i = 0; i < n && parent; i++) {
+        fprintf(parent, "add_subdirectory(%s)\n", sub);
+        if (parent != f) fclose(parent);
+        parent = bench_open(sub);
+        if (parent) {
+            fprintf(parent, "add_library(level%d STATIC level%d.c)\n", i, i);
+            fprintf(parent, "target_include_directories(level%d PUBLIC .)\n", i);
+            if (i) fprintf(parent, "target_link_libraries(level%d PUBLIC level%d)\n", i, i - 1);
+        }
+        char *next = str_printf("%s/d", sub);
+        free(sub);
+        sub = next;
     }
+    if (parent && parent != f) fclose(parent);
+    free(sub);
+}
+// n sibling subdirectories with one library each
+static void bench_wide(FILE *f, const char *dir, int n) {
+    bench_project(f);
+    for (int i = 0; i < n; i++) {
+        char *sub = str_printf("%s/mod%d", dir, i);
+        fprintf(f, "add_subdirectory(%s)\n", sub);
+        FILE *g = bench_open(sub);
+        if (g) {
+            fprintf(g, "set(MOD_NAME mod%d)\nadd_library(${MOD_NAME} STATIC ${MOD_NAME}.c)\n", i);
+            fclose(g);
+        }
+        free(sub);
+    }
+}
+// n empty sources, 50 to a directory, gathered by file(GLOB_RECURSE)
+static void bench_glob(FILE *f, const char *dir, int n) {
+    bench_project(f);
+    fputs("file(GLOB_RECURSE SRCS src/*.c)\nadd_library(globbed STATIC ${SRCS})\n", f);
+    for (int i = 0; i < n; i++) {
+        char *src = str_printf("%s/src/m%d/s%d/f%d.c", dir, i / 500, i / 50, i);
+        if (i % 50 == 0) make_parent_dirs(src);
+        FILE *g = fopen(src, "w");
+        if (g) fclose(g);
+        free(src);
+    }
+}
+// n variables built from nested ${} references
+static void bench_expand(FILE *f, const char *dir, int n) {
+    (void)dir;
+    bench_project(f);
+    fputs("set(ROOT /opt/bench)\n", f);
+    for (int k = 0; k < 16; k++) fprintf(f, "set(PART%d part%d)\nset(SEL%d %d)\n", k, k, k, k);
+    fputs("add_library(expand STATIC expand.c)\n", f);
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "set(V%d \"${ROOT}/${PART%d}/${PART${SEL%d}}/v%d\")\n", i, i % 16, (i / 16) % 16, i);
+        if (i % 8 == 7)
+            fprintf(f, "set(L%d \"${V%d};${V%d};${V%d}\")\n", i, i, i / 2, i / 3);
+        if (i % 100 == 99)
+            fprintf(f, "target_compile_definitions(expand PRIVATE \"D%d=${L%d}\")\n", i, i - 4);
+    }
+}
+// if()/elseif() chains of 64 branches, n conditions in all
+static void bench_ifs(FILE *f, const char *dir, int n) {
+    (void)dir;
+    bench_project(f);
+    fputs("set(MODE m63)\nset(FLAG ON)\n", f);
+    for (int i = 0; i < n; i++) {
+        int branch = i % 64;
+        if (branch == 0) fputs("if(MODE STREQUAL m0)\n", f);
+        else fprintf(f, "elseif(MODE STREQUAL m%d)\n", branch);
+        fprintf(f, "  set(HIT%d %d)\n", i / 64, branch);
+        if (branch == 63 || i == n - 1) fputs("else()\n  set(HIT none)\nendif()\nif(FLAG)\n  set(SEEN ON)\nendif()\n", f);
+    }
+}
 
-    size_t buflen = 1024;
-    char *buf = malloc(buflen);
-    if (!buf) return;
-    buf[0] = '\0';
-
-    collect_files(dir, &buf, &buflen, ext);
+typedef struct {
+    const char *shape;
+    int scale;
+    void (*write)(FILE *f, const char *dir, int n);
+} BenchCase;
+
+static const BenchCase bench_cases[] = {
+    { "targets", 100, bench_targets },
+    { "targets", 1000, bench_targets },
+    { "targets", 10000, bench_targets },
+    { "targets", 50000, bench_targets },
+    { "subdirs-deep", 50, bench_deep },
+    { "subdirs-deep", 500, bench_deep },
+    { "subdirs-wide", 1000, bench_wide },
+    { "subdirs-wide", 5000, bench_wide },
+    { "glob", 1000, bench_glob },
+    { "glob", 20000, bench_glob },
+    { "expand", 1000, bench_expand },
+    { "expand", 50000, bench_expand },
+    { "if", 1000, bench_ifs },
+    { "if", 50000, bench_ifs },
+};
+#define NBENCH_CASES (int)(sizeof(bench_cases) / sizeof(bench_cases[0]))
 
-    setvar(var, buf);
-    DPRINTF("file(GLOB_RECURSE): %s = '%s'\n", var, buf);
+typedef struct {
+    long long wall_us;
+    long rss_kb;
+    long long nalloc, nbyte, arena_peak;   // reported by the child
+    int status;
+} BenchRun;
+
+// One fresh configure + generate in `dir`, with the outputs of the previous
+// run removed so every run writes them
+static void bench_run(const char *self, const Generator *gen, const char *dir, BenchRun *r) {
+    memset(r, 0, sizeof *r);
+    r->status = -1;
+    int fds[2];
+    if (pipe(fds) != 0) return;
+    fflush(stdout);
+    long long start = monotonic_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(dir) != 0) _exit(127);
+        unlink(gen->file);
+        unlink(CACHE_FILE);
+        execl(self, self, "--fresh", "--bench-stats", "--log-level=error", "-G", gen->name, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) { close(fds[0]); return; }
+    FILE *out = fdopen(fds[0], "r");
+    char line[256];
+    while (out && fgets(line, sizeof line, out))
+        sscanf(line, "bench-stats %lld %lld %lld", &r->nalloc, &r->nbyte, &r->arena_peak);
+    if (out) fclose(out);
+    else close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) return;
+    }
+    r->wall_us = monotonic_us() - start;
+#ifdef __APPLE__
+    r->rss_kb = ru.ru_maxrss / 1024;   // bytes
+#else
+    r->rss_kb = ru.ru_maxrss;          // KiB
+#endif
+    r->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+static int cmp_bench_wall(const void *a, const void *b) {
+    long long x = ((const BenchRun *)a)->wall_us, y = ((const BenchRun *)b)->wall_us;
+    return x < y ? -1 : x > y;
+}
+// mini_cmake --bench [--bench-runs N] [--bench-filter TEXT] [-G generator]
+static int run_benchmarks(const char *self, const Generator *gen, int runs, const char *filter) {
+    if (runs < 1) runs = 1;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof cwd)) return 1;
+    BenchRun *r = calloc(runs, sizeof(BenchRun));
+    int failed = 0;
+    for (int c = 0; c < NBENCH_CASES; c++) {
+        const BenchCase *bc = &bench_cases[c];
+        char *name = str_printf("%s-%d", bc->shape, bc->scale);
+        if (filter && !strstr(name, filter)) { free(name); continue; }
+        char *dir = str_printf("%s/" BENCH_ROOT "/%s", cwd, name);
+        FILE *f = bench_open(dir);
+        if (!f) {
+            printf("Could not write %s/CMakeLists.txt\n", dir);
+            free(name);
+            free(dir);
+            free(r);
+            return 1;
+        }
+        bc->write(f, dir, bc->scale);
+        fclose(f);
+
+        long rss = 0;
+        int status = 0;
+        for (int i = 0; i < runs; i++) {
+            bench_run(self, gen, dir, &r[i]);
+            if (r[i].rss_kb > rss) rss = r[i].rss_kb;
+            if (r[i].status != 0) status = r[i].status;
+        }
+        BenchRun last = r[runs - 1];
+        qsort(r, runs, sizeof(BenchRun), cmp_bench_wall);
+        fputs("{\"case\": ", stdout);
+        json_string(stdout, name);
+        fputs(", \"shape\": ", stdout);
+        json_string(stdout, bc->shape);
+        fputs(", \"generator\": ", stdout);
+        json_string(stdout, gen->name);
+        printf(", \"scale\": %d, \"runs\": %d, "
+               "\"wall_ms\": {\"min\": %.3f, \"median\": %.3f, \"max\": %.3f}, "
+               "\"allocs\": %lld, \"alloc_bytes\": %lld, \"arena_peak_bytes\": %lld, "
+               "\"peak_rss_kb\": %ld, \"status\": %d}\n",
+               bc->scale, runs, r[0].wall_us / 1000.0, r[runs / 2].wall_us / 1000.0,
+               r[runs - 1].wall_us / 1000.0, last.nalloc, last.nbyte, last.arena_peak, rss, status);
+        fflush(stdout);
+        if (status != 0) failed = 1;
+        free(name);
+        free(dir);
+    }
+    free(r);
+    return failed;
+}
+#endif
 
-    free(buf);
+// ---- Watch Mode ----
+// mini_cmake --watch stays running after it writes the build file and keeps
+// the configure tables in memory. The directories holding the scripts it read
+// and the ones its globs walked are watched (inotify on Linux, a check every
+// second elsewhere). A change is configured again in the directory that read
+// the script or ran the glob, on a configure thread as in Parallel
+// Subdirectories, and spliced into the tables in place of what that directory
+// added before. Only those targets are planned again, and the build file is
+// rewritten only when its text changed. A pinned directory is configured
+// again with its parent, and a change at the top configures everything.
+#ifndef _WIN32
+typedef struct {
+    int fd;                 // inotify; -1 to check every second instead
+    int *wds;               // watch descriptor of each watched directory
+    const char **dirs;
+    int n, cap;
+    const char **new_dirs;  // directories that gained a subdirectory
+    int nnew, new_cap;
+} Watcher;
+
+static void free_scope(Scope *s) {
+    free(s->vars);
+    free(s->index.keys);
+    free(s->index.vals);
+}
+// Empties the configure tables for a full configure
+static void watch_reset(void) {
+    for (int i = 0; i < nwatch_dir; i++)
+        if (watch_dirs[i].vars) free_scope(watch_dirs[i].vars);
+    nwatch_dir = 0;
+    reset_vars();
+    reset_targets();
+    nglobal_incs = nscript_files = nglob_record = nsource_props = nfunction = 0;
+    name_index_clear(&source_index);
+    name_index_clear(&function_index);
+    configure_error = 0;
+    flow = FLOW_NORMAL;
+    loop_depth = call_depth = 0;
+}
+// Replaces items[lo..hi) with the n elements at `with`. The array is copied
+// at the capacity arena_grow() expects for the new count.
+static void *splice_array(void *items, int *count, size_t elem, int lo, int hi, const void *with, int n) {
+    int total = *count - (hi - lo) + n;
+    size_t cap = 4;
+    while (cap < (size_t)total) cap *= 2;
+    char *out = arena_alloc(&config_arena, cap * elem);
+    if (lo) memcpy(out, items, lo * elem);
+    if (n) memcpy(out + lo * elem, with, n * elem);
+    if (*count > hi) memcpy(out + (lo + n) * elem, (char *)items + hi * elem, (*count - hi) * elem);
+    *count = total;
+    return out;
 }
-// ---- Main ----
-int main(void) {
-    setvar("CMAKE_C_FLAGS", "");
-    setvar("CMAKE_C_STANDARD", "99");
-    setvar("CMAKE_C_COMPILER", "gcc");  
-    #ifdef _WIN32
-        setvar("WIN32", "ON");
-        #ifdef _MSC_VER
-            setvar("MSVC", "ON");
-        #endif
-    #else
-        setvar("UNIX", "ON");
-        #ifdef __APPLE__
-            setvar("APPLE", "ON");
-        #endif
-    #endif
-    cond_stack[0] = 1; cond_level = 0;
 
-    FILE *f = fopen("CMakeLists.txt", "r");
-    if (!f) { puts("CMakeLists.txt not found."); return 1; }
+// Configures directory r again. 1 if it replaced what r added before, 0 if
+// its scripts failed, -1 if only a full configure gives the right result.
+static int watch_replay(int r) {
+    WatchDir old = watch_dirs[r];
+    SubdirJob j;
+    memset(&j, 0, sizeof j);
+    j.dir = old.dir;
+    j.scope = old.vars;
+    j.scope->shared = 1;        // set(PARENT_SCOPE) cannot be replayed
+    j.view.targets = targets;
+    j.view.target_index = &target_index;
+    j.view.ntarget = old.lo[WATCH_TARGETS];
+    j.view.functions = functions;
+    j.view.function_index = &function_index;
+    j.view.nfunction = old.lo[WATCH_FUNCTIONS];
+    // The thread allocates where this one left off, so a full configure
+    // still releases everything
+    j.arena = config_arena;
+    memset(&config_arena, 0, sizeof config_arena);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 8 << 20);
+    int started = pthread_create(&thread, &attr, subdir_thread, &j) == 0;
+    pthread_attr_destroy(&attr);
+    if (started) pthread_join(thread, NULL);
+    arena_adopt(&config_arena, &j.arena);
+    scratch_arena.nalloc += j.scratch_nalloc;
+    scratch_arena.nbyte += j.scratch_nbyte;
+    j.scope->shared = 0;
+
+    // It must define the same targets and functions, in the same order: code
+    // outside it looked them up by name
+    int same = started && !j.serial && !j.ninc && !j.nsource &&
+               j.ntarget == old.hi[WATCH_TARGETS] - old.lo[WATCH_TARGETS] &&
+               j.nfunction == old.hi[WATCH_FUNCTIONS] - old.lo[WATCH_FUNCTIONS];
+    for (int i = 0; same && i < j.ntarget; i++) same = j.targets[i].name == targets[old.lo[WATCH_TARGETS] + i].name;
+    for (int i = 0; same && i < j.nfunction; i++) same = j.functions[i].id == functions[old.lo[WATCH_FUNCTIONS] + i].id;
+    int rc = j.error && !j.serial ? 0 : same ? 1 : -1;
+    if (rc >= 0) fwrite(j.out, 1, j.nout, stdout);
+    if (rc < 0) DPRINTF("watch: %s changed what other directories see\n", old.dir);
+
+    if (rc > 0) {
+        int end = old.hi[WATCH_DIRS], delta[WATCH_NTABLE];
+        for (int t = 0; t < WATCH_NTABLE; t++) delta[t] = j.dirs[0].hi[t] - (old.hi[t] - old.lo[t]);
+        for (int i = 0; i < j.ntarget; i++) {
+            Target *t = &targets[old.lo[WATCH_TARGETS] + i];
+            *t = j.targets[i];
+            t->dir += r;
+            ArenaMark mark = arena_mark(&scratch_arena);
+            plan_target_sources(t);
+            arena_release(&scratch_arena, mark);
+        }
+        for (int i = 0; i < j.nfunction; i++) {
+            functions[old.lo[WATCH_FUNCTIONS] + i] = j.functions[i];
+            functions[old.lo[WATCH_FUNCTIONS] + i].dir += r;
+        }
+        for (int i = old.hi[WATCH_TARGETS]; i < ntarget; i++) targets[i].dir += delta[WATCH_DIRS];
+        for (int i = old.hi[WATCH_FUNCTIONS]; i < nfunction; i++) functions[i].dir += delta[WATCH_DIRS];
+        script_files = splice_array(script_files, &nscript_files, sizeof(char *), old.lo[WATCH_SCRIPTS],
+                                    old.hi[WATCH_SCRIPTS], j.scripts, j.nscript);
+        glob_records = splice_array(glob_records, &nglob_record, sizeof(GlobRecord), old.lo[WATCH_GLOBS],
+                                    old.hi[WATCH_GLOBS], j.globs, j.nglob);
+
+        // Directories after r and the ones r runs in move by what it added
+        for (int d = old.parent; d >= 0; d = watch_dirs[d].parent)
+            for (int t = 0; t < WATCH_NTABLE; t++) watch_dirs[d].hi[t] += delta[t];
+        for (int d = end; d < nwatch_dir; d++) {
+            for (int t = 0; t < WATCH_NTABLE; t++) {
+                watch_dirs[d].lo[t] += delta[t];
+                watch_dirs[d].hi[t] += delta[t];
+            }
+            if (watch_dirs[d].parent >= end) watch_dirs[d].parent += delta[WATCH_DIRS];
+        }
+        for (int d = 0; d < j.ndir; d++) {
+            for (int t = 0; t < WATCH_NTABLE; t++) {
+                j.dirs[d].lo[t] += old.lo[t];
+                j.dirs[d].hi[t] += old.lo[t];
+            }
+            j.dirs[d].parent = j.dirs[d].parent < 0 ? old.parent : j.dirs[d].parent + r;
+        }
+        for (int d = r; d < end; d++) free_scope(watch_dirs[d].vars);
+        watch_dirs = splice_array(watch_dirs, &nwatch_dir, sizeof(WatchDir), r, end, j.dirs, j.ndir);
+
+        // What it used from the directories before it pins them, as if it
+        // had run in place
+        for (int d = old.parent; d >= 0; d = watch_dirs[d].parent) watch_dirs[d].active = 1;
+        watch_cur = old.parent;
+        for (size_t i = 0; i < j.outer.cap; i++) {
+            const char *k = j.outer.keys[i];
+            int idx = k ? name_index_get(&target_index, k) : -1;
+            if (idx >= 0 && idx < old.lo[WATCH_TARGETS]) watch_touch(targets[idx].dir);
+            idx = k ? name_index_get(&function_index, k) : -1;
+            if (idx >= 0 && idx < old.lo[WATCH_FUNCTIONS]) watch_touch(functions[idx].dir);
+        }
+        watch_cur = -1;
+        for (int d = old.parent; d >= 0; d = watch_dirs[d].parent) watch_dirs[d].active = 0;
+    }
+    free(j.out);
+    free(j.targets);
+    free(j.outer.keys);
+    free(j.outer.vals);
+    return rc;
+}
 
-    char cwd[256];
-    if (getcwd(cwd, sizeof(cwd))) {
-        setvar("CMAKE_CURRENT_LIST_DIR", cwd);
+// The directory to configure again for a change to entry i of a table: the
+// innermost one that added it, or the nearest parent that is not pinned.
+// 0, the top directory, means everything.
+static int watch_root(int table, int i) {
+    int d = 0;
+    for (int k = nwatch_dir - 1; k > 0; k--)
+        if (watch_dirs[k].lo[table] <= i && i < watch_dirs[k].hi[table]) {
+            d = k;
+            break;
+        }
+    while (d > 0 && watch_dirs[d].pinned) d = watch_dirs[d].parent;
+    return d;
+}
+// Finds what changed since the scripts were read and the globs ran. Fills
+// roots with the directories to configure again, last first, or sets *full.
+// 0 if nothing changed.
+static int watch_changes(Watcher *w, int **roots, int *nroot, int *full) {
+    char *want = calloc(nwatch_dir + 1, 1);
+    int any = 0;
+    for (int i = 0; i < nwatch_file; i++) {
+        WatchFile *f = &watch_files[i];
+        long long mtime = file_mtime(f->path);
+        if (mtime == f->mtime) continue;
+        f->mtime = mtime;
+        unsigned long long hash = hash_file(f->path);
+        if (hash == f->hash) continue;
+        f->hash = hash;
+        for (int k = 0; k < nscript_files; k++) {
+            if (strcmp(script_files[k], f->path) != 0) continue;
+            printf("-- Changed: %s\n", f->path);
+            any = 1;
+            want[watch_root(WATCH_SCRIPTS, k)] = 1;
+            break;
+        }
     }
+    for (int i = 0; i < nglob_record; i++) {
+        GlobRecord *rec = &glob_records[i];
+        int changed = 0;
+        // A new directory can be empty yet, but it must be watched from now on
+        for (int k = 0; !changed && (rec->flags & GLOB_RECURSE_BIT) && k < w->nnew; k++)
+            changed = find_sorted(rec->dirs, rec->ndir, w->new_dirs[k]) >= 0;
+        if (!changed) changed = !glob_unchanged(rec);
+        if (!changed) continue;
+        printf("-- file(GLOB) changed: %s\n", rec->pattern);
+        any = 1;
+        want[watch_root(WATCH_GLOBS, i)] = 1;
+    }
+    w->nnew = 0;
+
+    *nroot = 0;
+    if (want[0]) *full = 1;
+    for (int d = nwatch_dir - 1; !*full && d > 0; d--) {
+        if (!want[d]) continue;
+        int p = watch_dirs[d].parent;
+        while (p > 0 && !want[p]) p = watch_dirs[p].parent;
+        if (p > 0) continue;    // configured with a parent
+        *roots = realloc(*roots, (*nroot + 1) * sizeof(int));
+        (*roots)[(*nroot)++] = d;
+    }
+    free(want);
+    return any;
+}
 
-    char cmdline[MAX_LINE*16];
-    while (read_cmake_cmd(f, cmdline, sizeof cmdline)) {
-        char expcmd[MAX_LINE*16];
-        expand_vars(cmdline, expcmd, sizeof expcmd);
-
-        // --- CONDITION handling
-        if (strncmp(expcmd, "if(", 3) == 0) {
-            const char *start = strchr(expcmd, '(');
-            const char *end   = strrchr(expcmd, ')');
-            char expr[512] = {0};
-            if (start && end && end > start) {
-                strncpy(expr, start + 1, end - start - 1);
-                char *first = expr;
-                while (*first == ' ' || *first == '\t' || *first == '\n') first++;
-                char *last = first + strlen(first) - 1;
-                while (last > first && (*last == ' ' || *last == '\t' || *last == '\n')) *last-- = 0;
-                cond_push(eval_simple_if(first));
-            } else {
-                cond_push(0);
+static void watch_add_dir(Watcher *w, const char *dir) {
+#ifdef __linux__
+    int wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE |
+                                           IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+        if (errno != ENOENT) {
+            printf("-- Could not watch %s (%s), checking every second instead\n", dir, strerror(errno));
+            close(w->fd);
+            w->fd = -1;
+        }
+        return;
+    }
+    if (w->n == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 64;
+        w->wds = realloc(w->wds, w->cap * sizeof(int));
+        w->dirs = realloc(w->dirs, w->cap * sizeof(char *));
+    }
+    w->wds[w->n] = wd;
+    w->dirs[w->n++] = dir;
+#else
+    (void)w;
+    (void)dir;
+#endif
+}
+// Watches the directories of every script read and every directory a glob
+// walked, each once. An editor saving a script may replace the file, so the
+// directory is watched rather than the file.
+static void watch_arm(Watcher *w) {
+    if (w->fd >= 0) close(w->fd);
+    w->n = 0;
+#ifdef __linux__
+    w->fd = inotify_init1(IN_CLOEXEC);
+#else
+    w->fd = -1;
+#endif
+    NameIndex seen = {0};
+    char parent[4096];
+    for (int i = 0; w->fd >= 0 && i < nscript_files + nglob_record; i++) {
+        const GlobRecord *rec = i < nscript_files ? NULL : &glob_records[i - nscript_files];
+        int ndir = rec ? rec->ndir : 1;
+        for (int k = 0; w->fd >= 0 && k < ndir; k++) {
+            const char *dir = rec ? rec->dirs[k] : walk_parent(script_files[i], parent, sizeof parent);
+            const char *key = intern_n(dir, strlen(dir));
+            if (name_index_get(&seen, key) >= 0) continue;
+            name_index_put(&seen, key, 0);
+            watch_add_dir(w, key);
+        }
+    }
+    free(seen.keys);
+    free(seen.vals);
+}
+// Waits for the next change to a watched directory. Saving a file takes an
+// editor several steps, so events are read until there is a short pause.
+static void watch_wait(Watcher *w) {
+    if (w->fd < 0) {
+        // Without inotify a new directory is only seen once it holds a match
+        poll(NULL, 0, 1000);
+        return;
+    }
+#ifdef __linux__
+    struct pollfd p = { w->fd, POLLIN, 0 };
+    int timeout = -1;
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (poll(&p, 1, timeout) > 0) {
+        ssize_t len = read(w->fd, buf, sizeof buf);
+        if (len <= 0) break;
+        for (char *e = buf; e < buf + len; e += sizeof(struct inotify_event) + ((struct inotify_event *)e)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)e;
+            if (!(ev->mask & IN_ISDIR) || !(ev->mask & (IN_CREATE | IN_MOVED_TO))) continue;
+            for (int i = 0; i < w->n; i++) {
+                if (w->wds[i] != ev->wd) continue;
+                if (w->nnew == w->new_cap) {
+                    w->new_cap = w->new_cap ? w->new_cap * 2 : 16;
+                    w->new_dirs = realloc(w->new_dirs, w->new_cap * sizeof(char *));
+                }
+                w->new_dirs[w->nnew++] = w->dirs[i];
             }
-            continue;
         }
-        if (strncmp(expcmd, "elseif(", 7) == 0) {
-            if (cond_level > 0) cond_level--;
+        timeout = 50;
+    }
+#endif
+}
 
-            const char *start = strchr(expcmd, '(');
-            const char *end   = strrchr(expcmd, ')');
-            char expr[512] = {0};
+// Configures the whole project from the start, reusing the arena from `base`
+static int watch_configure_all(const char *self, const Generator *gen, ArenaMark base) {
+    watch_reset();
+    arena_release(&config_arena, base);
+    setvar("CMAKE_COMMAND", self);
+    setvar("CMAKE_GENERATOR", gen->name);
+    set_default_vars();
+    return configure_project(1) == 0;
+}
+// mini_cmake --watch [-G generator] [-D...]: runs until interrupted
+// Replaced targets have no rules yet; anything that links one, or takes
+// its precompiled header, is generated again too
+static void watch_stale_rules(void) {
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < ntarget; i++) {
+            Target *t = &targets[i];
+            if (!t->rules) continue;
+            const Target *pch = t->pch_reuse ? find_target(t->pch_reuse) : NULL;
+            int stale = pch && !pch->rules;
+            for (int j = 0; !stale && j < t->nlink_item; j++) {
+                const Target *dep = link_dep(t->link_items[j]);
+                stale = dep && !dep->rules;
+            }
+            if (stale) {
+                t->rules = NULL;
+                changed = 1;
+            }
+        }
+    }
+}
+static int run_watch(const char *self, const Generator *gen) {
+    watching = 1;
+    ArenaMark base = arena_mark(&config_arena);
+    Watcher w = { .fd = -1 };
+    int full = 1, first = 1, *roots = NULL, nroot = 0;
+    size_t full_total = 0;
+    for (;;) {
+        long long start = monotonic_us();
+        int ok = 1;
+        // What a directory added before stays in the arena until a full
+        // configure releases it
+        if (config_arena.total > 2 * full_total) full = 1;
+        for (int i = 0; !full && i < nroot; i++) {
+            printf("-- Configuring %s again\n", watch_dirs[roots[i]].dir);
+            int rc = watch_replay(roots[i]);
+            if (rc < 0) full = 1;
+            if (rc == 0) {
+                ok = 0;
+                break;
+            }
+        }
+        if (full) {
+            if (!first) puts("-- Configuring the whole project again");
+            ok = watch_configure_all(self, gen, base);
+            full_total = config_arena.total;
+        }
+        if (ok) {
+            resolve_targets();
+            if (full) plan_sources();
+            else watch_stale_rules();
+            save_cache();
+            if (!write_build_file(gen)) return 1;
+            printf("Wrote to %s in %.1f ms. Watching for changes...\n", gen->file,
+                   (monotonic_us() - start) / 1000.0);
+        } else {
+            puts("-- Configuring failed. Watching for changes...");
+        }
+        fflush(stdout);
+        // After a failure the tables are not complete, the next change
+        // configures everything
+        full = !ok;
+        first = 0;
+        // Watching starts before the check, so a change made meanwhile is seen
+        watch_arm(&w);
+        while (!watch_changes(&w, &roots, &nroot, &full)) watch_wait(&w);
+    }
+}
+#endif
 
-            if (start && end && end > start) {
-                strncpy(expr, start + 1, end - start - 1);
-                char *first = expr;
-                while (*first == ' ' || *first == '\t' || *first == '\n') first++;
-                char *last = first + strlen(first) - 1;
-                while (last > first && (*last == ' ' || *last == '\t' || *last == '\n')) *last-- = 0;
-                cond_push(eval_simple_if(first));
-            } else {
-                cond_push(0);
+// ---- Main ----
+int main(int argc, char **argv) {
+    // The environment sets the level for the helper modes below too
+    const char *env_level = getenv("MINI_CMAKE_LOG_LEVEL");
+    if (env_level && parse_log_level(env_level) >= 0) log_level = parse_log_level(env_level);
+#ifndef _WIN32
+    if (argc > 1 && strcmp(argv[1], "--cache-compile") == 0) return cache_compile(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "--trace-step") == 0) return trace_step(argc - 2, argv + 2);
+#endif
+    const Generator *gen = &generators[0];
+    int build = 0, jobs = 0, fresh = 0, pgo = 0, trace = 0, report = 0, top = 10;
+    int bench = 0, bench_runs = 5, bench_stats = 0, watch = 0;
+    const char *bench_filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char *name = NULL;
+        if (strcmp(argv[i], "--build") == 0) { build = 1; continue; }
+        if (strcmp(argv[i], "--fresh") == 0) { fresh = 1; continue; }
+        if (strcmp(argv[i], "--pgo") == 0) { pgo = build = 1; continue; }
+        if (strcmp(argv[i], "--trace") == 0) { trace = 1; continue; }
+        if (strcmp(argv[i], "--profile-configure") == 0) { prof.enabled = fresh = 1; continue; }
+        if (strcmp(argv[i], "--bench") == 0) { bench = 1; continue; }
+        if (strcmp(argv[i], "--watch") == 0) { watch = 1; continue; }
+        if (strcmp(argv[i], "--bench-runs") == 0 && i + 1 < argc) { bench_runs = atoi(argv[++i]); continue; }
+        if (strcmp(argv[i], "--bench-filter") == 0 && i + 1 < argc) { bench_filter = argv[++i]; continue; }
+        if (strcmp(argv[i], "--bench-stats") == 0) { bench_stats = 1; continue; }
+        if (strncmp(argv[i], "--log-level", 11) == 0) {
+            const char *level = argv[i][11] == '=' ? argv[i] + 12 : !argv[i][11] && i + 1 < argc ? argv[++i] : "";
+            log_level = parse_log_level(level);
+            if (log_level < 0) {
+                printf("Unknown log level: %s\nAvailable levels:", level);
+                for (int l = 0; l <= LOG_TRACE; l++) printf(" %s", log_level_names[l]);
+                puts("");
+                return 1;
             }
             continue;
         }
-        if (strncmp(expcmd, "else", 4)==0) {
-            if (cond_level) cond_stack[cond_level] = !cond_stack[cond_level];
-            if (DEBUG) DPRINTF("else reached. inverting cond to %d\n", cond_stack[cond_level]);
+        if (strcmp(argv[i], "--trace-report") == 0) {
+            report = 1;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) top = atoi(argv[++i]);
             continue;
         }
-        if (strncmp(expcmd, "endif", 5)==0) {
-            cond_pop();
+        if (strcmp(argv[i], "--verify-globs") == 0) return verify_globs();
+        if (strncmp(argv[i], "-D", 2) == 0) {
+            // -DVAR=value, -D VAR=value; a :TYPE after the name is ignored
+            const char *def = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "";
+            const char *eq = strchr(def, '=');
+            if (!eq || eq == def) {
+                printf("Invalid definition: -D%s\n", def);
+                return 1;
+            }
+            const char *colon = memchr(def, ':', eq - def);
+            StrBuf b = {0};
+            sb_putn(&b, def, (colon ? colon : eq) - def);
+            sb_puts(&b, eq);
+            add_string(&cmdline_defs, &ncmdline_def, sb_str(&b));
             continue;
         }
-        if (!cond_active()) {
-            if (DEBUG) DPRINTF("Skipping command (inactive condition): %s\n", expcmd);
+        if (strncmp(argv[i], "-j", 2) == 0) {
+            if (argv[i][2]) jobs = atoi(argv[i] + 2);
+            else if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) jobs = atoi(argv[++i]);
             continue;
         }
-
-        // --- COMMAND HANDLING ---
-        if (strncmp(expcmd, "set(", 4)==0)
-            cmd_set(expcmd+4);
-        else if (strncmp(expcmd, "project(", 8)==0)
-            cmd_project(expcmd+8);
-        else if (strncmp(expcmd, "file(GLOB_RECURSE", 17)==0)
-            cmd_file_glob(expcmd+17);
-        else if (strncmp(expcmd, "add_definitions(", 16)==0)
-            cmd_add_definitions(expcmd+16);
-        else if (strncmp(expcmd, "add_executable(",15)==0)
-            cmd_add_executable(expcmd+15);
-        else if (strncmp(expcmd, "add_library(", 12)==0)
-            cmd_add_library(expcmd+12);
-        else if (strncmp(expcmd, "include_directories(",20)==0)
-            cmd_include_directories_global(expcmd+20);
-        else if (strncmp(expcmd, "target_include_directories(",27)==0)
-            cmd_include_dirs(expcmd+27);
-        else if (strncmp(expcmd, "target_link_libraries(", 21)==0)
-            cmd_target_link_libs(expcmd+21);
-        else if (strncmp(expcmd, "include(", 8)==0)
-            cmd_include(expcmd+8);
-        else if (strncmp(expcmd, "cmake_minimum_required(", 23)==0)
-            cmd_cmake_minimum_required(expcmd+23);
-        else if (strncmp(expcmd, "message(", 8)==0)
-            cmd_message(expcmd+8);
-        else if (strncmp(expcmd, "add_compile_options(", 20)==0)
-            cmd_add_compile_options(expcmd+20);
-        else if (strncmp(expcmd, "add_subdirectory(", 16)==0)
-            cmd_add_subdirectory(expcmd+16);
-
-        // --- STUBS for advanced features ---
-        else if (strncmp(expcmd, "FetchContent_Declare(", 20)==0)
-            DPRINTF("Skipping FetchContent_Declare\n");
-        else if (strncmp(expcmd, "FetchContent_MakeAvailable(", 27)==0)
-            DPRINTF("Skipping FetchContent_MakeAvailable\n");
-        else if (strncmp(expcmd, "find_package(", 13)==0)
-            DPRINTF("Skipping find_package\n");
-        else if (strncmp(expcmd, "target_link_options(", 20)==0)
-            DPRINTF("Skipping target_link_options\n");
-        else if (strncmp(expcmd, "set_source_files_properties(", 28)==0)
-            DPRINTF("Skipping set_source_files_properties\n");
-        else if (strncmp(expcmd, "set_target_properties(", 22)==0)
-            DPRINTF("Skipping set_target_properties\n");
-        else if (DEBUG)
-            DPRINTF("Unknown or skipped command: %s\n", expcmd);
+        if (strcmp(argv[i], "-G") == 0 && i + 1 < argc) name = argv[++i];
+        else if (strncmp(argv[i], "-G", 2) == 0 && argv[i][2]) name = argv[i] + 2;
+        else {
+            printf("Unknown argument: %s\n", argv[i]);
+            return 1;
+        }
+        gen = find_generator(name);
+        if (!gen) {
+            printf("Unknown generator: %s\nAvailable generators:\n", name);
+            for (int g = 0; g < NGENERATORS; g++) printf("  %s\n", generators[g].name);
+            return 1;
+        }
     }
 
-    fclose(f);
+    char self[4096];
+    find_self(argv[0], self, sizeof self);
+    if (bench) {
+#ifndef _WIN32
+        return run_benchmarks(self, gen, bench_runs, bench_filter);
+#else
+        puts("--bench is not supported on this platform.");
+        return 1;
+#endif
+    }
 
-    // ---- Write out Makefile ----
-    FILE *mk = fopen("Makefile", "w");
-    fprintf(mk, "all:");
-    for (int i = 0; i < ntarget; i++) {
-    Target *t = &targets[i];
-        if (!*t->name) continue;
-        if (strcmp(t->type, "EXE") == 0) fprintf(mk, " %s", t->name);
-        else if (strcmp(t->type, "STATIC") == 0) fprintf(mk, " lib%s.a", t->name);
-        else if (strcmp(t->type, "SHARED") == 0) fprintf(mk, " lib%s%s", t->name, SHARED_NAME);
+    if (!ncmdline_def && !fresh) load_cached_defs();
+    if (watch) {
+#ifndef _WIN32
+        return run_watch(self, gen);
+#else
+        puts("--watch is not supported on this platform.");
+        return 1;
+#endif
     }
-    fprintf(mk, "\n\n");
+    int cached = !fresh && load_cache();
 
-    for (int i = 0; i < ntarget; i++) {
-        Target *t = &targets[i];
-        if (!*t->name) continue;
+    setvar("CMAKE_COMMAND", self);
+    setvar("CMAKE_GENERATOR", gen->name);
 
-        if (strcmp(t->type, "EXE") == 0) {
-            fprintf(mk, "%s: ", t->name);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, "%s ", t->srcs[j]);
-            for (int j = 0; j < t->nlib; j++) fprintf(mk, "lib%s%s ", t->libs[j], SHARED_NAME);
-            fprintf(mk, "\n\t%s %s -L. %s",
-                    getvar("CMAKE_C_COMPILER"),
-                    getvar("CMAKE_C_FLAGS"),
-                    EXE_RULES);
-            if (strcmp(getvar("CMAKE_C_STANDARD"), "11") == 0) fprintf(mk, " -std=c11");
-            for (int j = 0; j < t->ndef; j++) fprintf(mk, " %s", t->defs[j]);
-            for (int j = 0; j < t->ninc; j++) fprintf(mk, " -I%s", t->incs[j]);
-            for (int j = 0; j < nglobal_incs; j++) fprintf(mk, " -I%s", global_incs[j]);
-            for (int j = 0; j < t->nsrc; j++)fprintf(mk, " %s", t->srcs[j]);
-            for (int j = 0; j < t->nlib; j++) fprintf(mk, " -l%s", t->libs[j]);
-            fprintf(mk, " -o %s\n\n", t->name);
-        } else if (strcmp(t->type, "STATIC") == 0) {
-            fprintf(mk, "lib%s.a: ", t->name);
-            // fprintf(mk, " -L. ");
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, "%s ", t->srcs[j]);
-            fprintf(mk, "\n\t%s %s", getvar("CMAKE_C_COMPILER"), getvar("CMAKE_C_FLAGS"));
-            if (strcmp(getvar("CMAKE_C_STANDARD"), "11")==0) fprintf(mk," -std=c11");
-            for (int j = 0; j < t->ndef; j++) fprintf(mk, " %s", t->defs[j]);
-            for (int j = 0; j < t->ninc; j++) fprintf(mk, " -I%s", t->incs[j]);
-            for (int j = 0; j < nglobal_incs; j++) fprintf(mk, " -I%s", global_incs[j]);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, " %s", t->srcs[j]);
-            fprintf(mk, "\n\tar rcs lib%s.a *.o\n\n", t->name);
-        } else if (strcmp(t->type, "STATIC") == 0) {
-            fprintf(mk, "        lib%s.a: ", t->name);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, "%s ", t->srcs[j]);
-            fprintf(mk, "\n\t%s %s",
-                    getvar("CMAKE_C_COMPILER"),
-                    getvar("CMAKE_C_FLAGS"));
-            if (strcmp(getvar("CMAKE_C_STANDARD"), "11") == 0) fprintf(mk, " -std=c11");
-            for (int j = 0; j < t->ndef; j++) fprintf(mk, " %s", t->defs[j]);
-            for (int j = 0; j < t->ninc; j++) fprintf(mk, " -I%s", t->incs[j]);
-            for (int j = 0; j < nglobal_incs; j++) fprintf(mk, " -I%s", global_incs[j]);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, " %s", t->srcs[j]);
-            fprintf(mk, "\n        \tar rcs lib%s.a *.o\n\n", t->name);
-        } else if (strcmp(t->type, "SHARED") == 0) {
-            fprintf(mk, "lib%s%s: ", t->name, SHARED_NAME);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, "%s ", t->srcs[j]);
-            fprintf(mk, "\n\t%s -shared -fPIC %s -L. %s",
-                    getvar("CMAKE_C_COMPILER"),
-                    getvar("CMAKE_C_FLAGS"),
-                    LINK_RULES);
-            if (strcmp(getvar("CMAKE_C_STANDARD"), "11") == 0) fprintf(mk, " -std=c11");
-            for (int j = 0; j < t->ndef; j++) fprintf(mk, " %s", t->defs[j]);
-            for (int j = 0; j < t->ninc; j++) fprintf(mk, " -I%s", t->incs[j]);
-            for (int j = 0; j < nglobal_incs; j++) fprintf(mk, " -I%s", global_incs[j]);
-            for (int j = 0; j < t->nsrc; j++) fprintf(mk, " %s", t->srcs[j]);
-            for (int j = 0; j < t->nlib; j++) fprintf(mk, " -l%s", t->libs[j]);
-            fprintf(mk, " -o lib%s%s\n\n", t->name, SHARED_NAME);
-        }
-    }
-
-    fprintf(mk, "clean:\n\trm -f *.o *.a *%s ", SHARED_NAME);
-    for (int i = 0; i < ntarget; i++) {
-        Target *t = &targets[i];
-        if (!*t->name) continue;
-        if (strcmp(t->type, "EXE") == 0) fprintf(mk, "%s ", t->name);
-        else if (strcmp(t->type, "STATIC") == 0) fprintf(mk, "lib%s.a ", t->name);
-        else if (strcmp(t->type, "SHARED") == 0) fprintf(mk, "lib%s%s ", t->name, SHARED_NAME);
+    if (cached) {
+        printf("Configure inputs unchanged, using %s\n", CACHE_FILE);
+    } else {
+        set_default_vars();
+
+        long long start = prof.enabled ? monotonic_us() : 0;
+#ifndef _WIN32
+        // -j also caps the threads sibling subdirectories are configured on
+        if (configure_project(jobs > 0 ? jobs : (int)sysconf(_SC_NPROCESSORS_ONLN)) != 0) return 1;
+#else
+        if (configure_project(1) != 0) return 1;
+#endif
+        if (prof.enabled) print_configure_profile(monotonic_us() - start);
+        save_cache();
+    }
+    resolve_targets();
+    plan_sources();
+
+    if (report) {
+#ifndef _WIN32
+        return trace_report(top);
+#else
+        puts("--trace-report is not supported on this platform.");
+        return 1;
+#endif
+    }
+    if (build) {
+#ifndef _WIN32
+        if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (pgo) return run_pgo(jobs);
+        if (strcasecmp(getvar("CMAKE_PGO_PHASE"), "USE") == 0) report_profiles();
+        int rc = run_build(jobs);
+        if (trace || build_trace_enabled()) write_build_trace(top);
+        return rc;
+#else
+        puts("--build is not supported on this platform.");
+        return 1;
+#endif
     }
-    fprintf(mk, "\n");
-    fclose(mk);
 
-    puts("Wrote to Makefile. Type 'make'");
+    if (!write_build_file(gen)) return 1;
+#ifndef _WIN32
+    if (strcasecmp(getvar("CMAKE_PGO_PHASE"), "USE") == 0) report_profiles();
+#endif
+    printf("Wrote to %s. Type '%s'\n", gen->file, gen->tool);
+    // Read back by --bench: arena allocations, bytes asked for, peak reserved
+    if (bench_stats)
+        printf("bench-stats %zu %zu %zu\n", config_arena.nalloc + scratch_arena.nalloc + intern_arena.nalloc,
+               config_arena.nbyte + scratch_arena.nbyte + intern_arena.nbyte,
+               config_arena.peak + scratch_arena.peak + intern_arena.peak);
     return 0;
 }